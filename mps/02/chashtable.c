@@ -0,0 +1,449 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable.h"
+#include "chashtable.h"
+
+#define CACHELINE           64
+#define CHT_MAX_THREADS     256
+#define CHT_DEFAULT_STRIPES 64
+/* retires between attempts to move the global epoch forward */
+#define EBR_ADVANCE_EVERY   64
+
+/* Epoch-based reclamation. Each thread announces the global epoch when it
+   enters a critical section. The epoch only advances once every active
+   thread has announced the current one, so anything retired in epoch e is
+   unreachable to all readers by the time the epoch reaches e + 2. Retired
+   objects sit in one of three per-thread bags (epoch % 3) and a bag is
+   emptied when its slot comes round again. */
+
+typedef struct ebr_entry ebr_entry_t;
+struct ebr_entry {
+  ebr_entry_t *next;
+  void (*reclaim)(ebr_entry_t *e);
+};
+
+typedef struct {
+  _Atomic unsigned long epoch;
+  _Atomic int active;
+  int nest;
+  unsigned long retired;
+  ebr_entry_t *bags[3];
+  unsigned long bag_epoch[3];
+} __attribute__((aligned(CACHELINE))) ebr_record_t;
+
+typedef struct cht_node cht_node_t;
+struct cht_node {
+  ebr_entry_t retire;       /* must be first */
+  unsigned long hash;
+  char *key;
+  void *val;
+  int owns;                 /* free key and val along with the node */
+  _Atomic(cht_node_t *) next;
+};
+
+typedef struct {
+  ebr_entry_t retire;       /* must be first */
+  unsigned long size;
+  _Atomic(cht_node_t *) *buckets;
+} cht_table_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  unsigned long count;      /* entries in this stripe's buckets */
+} __attribute__((aligned(CACHELINE))) cht_stripe_t;
+
+struct chashtable {
+  _Atomic(cht_table_t *) table;
+  cht_stripe_t *stripes;    /* bucket i belongs to stripe i % nstripes */
+  unsigned int nstripes;
+  double max_load;
+  _Atomic unsigned long epoch;
+  ebr_record_t records[CHT_MAX_THREADS];
+};
+
+/* small per-thread ids index the epoch records; they're recycled when a
+   thread exits */
+
+static pthread_mutex_t tid_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tid_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tid_key;
+static int tid_free[CHT_MAX_THREADS];
+static int tid_nfree;
+static _Atomic int tid_next;
+static __thread int my_tid = -1;
+
+static void tid_release(void *arg) {
+  pthread_mutex_lock(&tid_lock);
+  tid_free[tid_nfree++] = (int)(long)arg - 1;
+  pthread_mutex_unlock(&tid_lock);
+}
+
+static void tid_init(void) {
+  pthread_key_create(&tid_key, tid_release);
+}
+
+static int thread_id(void) {
+  if (my_tid < 0) {
+    pthread_once(&tid_once, tid_init);
+    pthread_mutex_lock(&tid_lock);
+    my_tid = tid_nfree ? tid_free[--tid_nfree] : tid_next++;
+    pthread_mutex_unlock(&tid_lock);
+    if (my_tid >= CHT_MAX_THREADS) {
+      abort();
+    }
+    /* stored off by one, since a NULL value skips the destructor */
+    pthread_setspecific(tid_key, (void *)(long)(my_tid + 1));
+  }
+  return my_tid;
+}
+
+static void ebr_enter(chashtable_t *ht) {
+  ebr_record_t *r = &ht->records[thread_id()];
+  if (r->nest++ == 0) {
+    atomic_store_explicit(&r->active, 1, memory_order_relaxed);
+    atomic_store_explicit(&r->epoch, atomic_load_explicit(&ht->epoch, memory_order_relaxed),
+                          memory_order_relaxed);
+    /* one full fence orders the announcement before any pointer loads */
+    atomic_thread_fence(memory_order_seq_cst);
+  }
+}
+
+static void ebr_exit(chashtable_t *ht) {
+  ebr_record_t *r = &ht->records[thread_id()];
+  if (--r->nest == 0) {
+    atomic_store_explicit(&r->active, 0, memory_order_release);
+  }
+}
+
+static void ebr_free_bag(ebr_entry_t *e) {
+  ebr_entry_t *next;
+  while (e) {
+    next = e->next;
+    e->reclaim(e);
+    e = next;
+  }
+}
+
+static void ebr_try_advance(chashtable_t *ht) {
+  unsigned long e;
+  int i, n = atomic_load(&tid_next);
+  /* pairs with the fence in ebr_enter: our unlinks are visible before we
+     look at who is reading */
+  atomic_thread_fence(memory_order_seq_cst);
+  e = atomic_load(&ht->epoch);
+  for (i = 0; i < n && i < CHT_MAX_THREADS; i++) {
+    if (atomic_load(&ht->records[i].active)
+        && atomic_load(&ht->records[i].epoch) != e) {
+      return;
+    }
+  }
+  atomic_compare_exchange_strong(&ht->epoch, &e, e + 1);
+}
+
+/* must be called after e has been unlinked from everything readers see */
+static void ebr_retire(chashtable_t *ht, ebr_entry_t *e) {
+  ebr_record_t *r = &ht->records[thread_id()];
+  unsigned long epoch = atomic_load(&ht->epoch);
+  int slot = epoch % 3;
+  if (r->bag_epoch[slot] != epoch) {
+    /* this bag was filled at epoch - 3 or earlier, so it's safe now */
+    ebr_free_bag(r->bags[slot]);
+    r->bags[slot] = NULL;
+    r->bag_epoch[slot] = epoch;
+  }
+  e->next = r->bags[slot];
+  r->bags[slot] = e;
+  if (++r->retired % EBR_ADVANCE_EVERY == 0) {
+    ebr_try_advance(ht);
+  }
+}
+
+static void reclaim_node(ebr_entry_t *e) {
+  cht_node_t *b = (cht_node_t *)e;
+  if (b->owns) {
+    free(b->key);
+    free(b->val);
+  }
+  free(b);
+}
+
+static void reclaim_table(ebr_entry_t *e) {
+  cht_table_t *t = (cht_table_t *)e;
+  free(t->buckets);
+  free(t);
+}
+
+static cht_node_t *new_node(unsigned long h, char *key, void *val) {
+  cht_node_t *b = malloc(sizeof(cht_node_t));
+  b->retire.reclaim = reclaim_node;
+  b->hash = h;
+  b->key = key;
+  b->val = val;
+  b->owns = 1;
+  atomic_init(&b->next, NULL);
+  return b;
+}
+
+static cht_table_t *new_table(unsigned long size) {
+  cht_table_t *t = malloc(sizeof(cht_table_t));
+  t->retire.reclaim = reclaim_table;
+  t->size = size;
+  t->buckets = calloc(sizeof(t->buckets[0]), size);
+  return t;
+}
+
+chashtable_t *make_chashtable(unsigned long size, unsigned int nstripes,
+                              double max_load) {
+  chashtable_t *ht;
+  unsigned int i;
+  if (posix_memalign((void **)&ht, CACHELINE, sizeof(chashtable_t)) != 0) {
+    return NULL;
+  }
+  memset(ht, 0, sizeof(chashtable_t));
+  ht->nstripes = nstripes ? nstripes : CHT_DEFAULT_STRIPES;
+  if (posix_memalign((void **)&ht->stripes, CACHELINE,
+                     sizeof(cht_stripe_t) * ht->nstripes) != 0) {
+    free(ht);
+    return NULL;
+  }
+  for (i = 0; i < ht->nstripes; i++) {
+    pthread_mutex_init(&ht->stripes[i].lock, NULL);
+    ht->stripes[i].count = 0;
+  }
+  ht->max_load = max_load;
+  atomic_init(&ht->table, new_table(size ? size : 1));
+  return ht;
+}
+
+/* locks the stripe covering h in the current table; retries if a resize
+   swapped the table between reading it and getting the lock */
+static cht_stripe_t *lock_bucket(chashtable_t *ht, unsigned long h,
+                                 cht_table_t **tp) {
+  cht_table_t *t;
+  cht_stripe_t *s;
+  for (;;) {
+    t = atomic_load_explicit(&ht->table, memory_order_acquire);
+    s = &ht->stripes[(h % t->size) % ht->nstripes];
+    pthread_mutex_lock(&s->lock);
+    if (atomic_load_explicit(&ht->table, memory_order_relaxed) == t) {
+      *tp = t;
+      return s;
+    }
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+static void lock_all(chashtable_t *ht) {
+  unsigned int i;
+  for (i = 0; i < ht->nstripes; i++) {
+    pthread_mutex_lock(&ht->stripes[i].lock);
+  }
+}
+
+static void unlock_all(chashtable_t *ht) {
+  unsigned int i;
+  for (i = ht->nstripes; i > 0; i--) {
+    pthread_mutex_unlock(&ht->stripes[i - 1].lock);
+  }
+}
+
+/* with every stripe held: copy the nodes into a new array, publish it,
+   then retire the old nodes (but not their keys/values) and array */
+static void resize_locked(chashtable_t *ht, unsigned long newsize) {
+  cht_table_t *old = atomic_load_explicit(&ht->table, memory_order_relaxed);
+  cht_table_t *t = new_table(newsize);
+  cht_node_t *b, *n;
+  unsigned long i, idx;
+  for (i = 0; i < ht->nstripes; i++) {
+    ht->stripes[i].count = 0;
+  }
+  for (i = 0; i < old->size; i++) {
+    for (b = atomic_load_explicit(&old->buckets[i], memory_order_relaxed); b;
+         b = atomic_load_explicit(&b->next, memory_order_relaxed)) {
+      n = new_node(b->hash, b->key, b->val);
+      idx = b->hash % newsize;
+      atomic_init(&n->next, t->buckets[idx]);
+      atomic_init(&t->buckets[idx], n);
+      ht->stripes[idx % ht->nstripes].count++;
+    }
+  }
+  atomic_store_explicit(&ht->table, t, memory_order_release);
+  for (i = 0; i < old->size; i++) {
+    for (b = atomic_load_explicit(&old->buckets[i], memory_order_relaxed); b;
+         b = atomic_load_explicit(&b->next, memory_order_relaxed)) {
+      b->owns = 0;
+      ebr_retire(ht, &b->retire);
+    }
+  }
+  ebr_retire(ht, &old->retire);
+}
+
+void cht_rehash(chashtable_t *ht, unsigned long newsize) {
+  ebr_enter(ht);
+  lock_all(ht);
+  resize_locked(ht, newsize ? newsize : 1);
+  unlock_all(ht);
+  ebr_exit(ht);
+}
+
+/* several writers may notice the same overload; only the first one to get
+   every lock while the table is still the one it saw does the work */
+static void grow(chashtable_t *ht, cht_table_t *seen) {
+  lock_all(ht);
+  if (atomic_load_explicit(&ht->table, memory_order_relaxed) == seen) {
+    resize_locked(ht, seen->size * 2);
+  }
+  unlock_all(ht);
+}
+
+void cht_put(chashtable_t *ht, char *key, void *val) {
+  unsigned long h = hash(key);
+  cht_table_t *t;
+  cht_stripe_t *s;
+  cht_node_t *b, *n;
+  _Atomic(cht_node_t *) *link, *head;
+  int overloaded;
+  ebr_enter(ht);
+  s = lock_bucket(ht, h, &t);
+  head = &t->buckets[h % t->size];
+  link = head;
+  for (b = atomic_load_explicit(link, memory_order_relaxed); b;
+       b = atomic_load_explicit(link, memory_order_relaxed)) {
+    if (b->hash == h && strcmp(b->key, key) == 0) {
+      break;
+    }
+    link = &b->next;
+  }
+  n = new_node(h, key, val);
+  if (b) {
+    /* readers may be standing on b, so swap in a new node rather than
+       editing b; b->next stays intact for anyone still walking past it */
+    atomic_init(&n->next, atomic_load_explicit(&b->next, memory_order_relaxed));
+    atomic_store_explicit(link, n, memory_order_release);
+    ebr_retire(ht, &b->retire);
+  } else {
+    atomic_init(&n->next, atomic_load_explicit(head, memory_order_relaxed));
+    atomic_store_explicit(head, n, memory_order_release);
+    s->count++;
+  }
+  overloaded = ht->max_load > 0
+    && s->count > ht->max_load * t->size / ht->nstripes;
+  pthread_mutex_unlock(&s->lock);
+  if (overloaded) {
+    grow(ht, t);
+  }
+  ebr_exit(ht);
+}
+
+void *cht_get(chashtable_t *ht, char *key) {
+  unsigned long h = hash(key);
+  cht_table_t *t;
+  cht_node_t *b;
+  void *val = NULL;
+  ebr_enter(ht);
+  t = atomic_load_explicit(&ht->table, memory_order_acquire);
+  for (b = atomic_load_explicit(&t->buckets[h % t->size], memory_order_acquire); b;
+       b = atomic_load_explicit(&b->next, memory_order_acquire)) {
+    if (b->hash == h && strcmp(b->key, key) == 0) {
+      val = b->val;
+      break;
+    }
+  }
+  ebr_exit(ht);
+  return val;
+}
+
+void cht_del(chashtable_t *ht, char *key) {
+  unsigned long h = hash(key);
+  cht_table_t *t;
+  cht_stripe_t *s;
+  cht_node_t *b;
+  _Atomic(cht_node_t *) *link;
+  ebr_enter(ht);
+  s = lock_bucket(ht, h, &t);
+  link = &t->buckets[h % t->size];
+  for (b = atomic_load_explicit(link, memory_order_relaxed); b;
+       b = atomic_load_explicit(link, memory_order_relaxed)) {
+    if (b->hash == h && strcmp(b->key, key) == 0) {
+      atomic_store_explicit(link, atomic_load_explicit(&b->next, memory_order_relaxed),
+                            memory_order_release);
+      /* key and val go with the node, once no reader can be using them */
+      ebr_retire(ht, &b->retire);
+      s->count--;
+      break;
+    }
+    link = &b->next;
+  }
+  pthread_mutex_unlock(&s->lock);
+  ebr_exit(ht);
+}
+
+void cht_iter(chashtable_t *ht, int (*f)(char *, void *)) {
+  cht_table_t *t;
+  cht_node_t *b;
+  unsigned long i;
+  ebr_enter(ht);
+  t = atomic_load_explicit(&ht->table, memory_order_acquire);
+  for (i = 0; i < t->size; i++) {
+    for (b = atomic_load_explicit(&t->buckets[i], memory_order_acquire); b;
+         b = atomic_load_explicit(&b->next, memory_order_acquire)) {
+      if (!f(b->key, b->val)) {
+        goto out; // abort iteration
+      }
+    }
+  }
+ out:
+  ebr_exit(ht);
+}
+
+unsigned long cht_count(chashtable_t *ht) {
+  unsigned long n = 0;
+  unsigned int i;
+  for (i = 0; i < ht->nstripes; i++) {
+    pthread_mutex_lock(&ht->stripes[i].lock);
+    n += ht->stripes[i].count;
+    pthread_mutex_unlock(&ht->stripes[i].lock);
+  }
+  return n;
+}
+
+unsigned long cht_size(chashtable_t *ht) {
+  return atomic_load_explicit(&ht->table, memory_order_acquire)->size;
+}
+
+void cht_read_begin(chashtable_t *ht) {
+  ebr_enter(ht);
+}
+
+void cht_read_end(chashtable_t *ht) {
+  ebr_exit(ht);
+}
+
+void free_chashtable(chashtable_t *ht) {
+  cht_table_t *t = atomic_load(&ht->table);
+  cht_node_t *b, *next;
+  unsigned long i;
+  int j;
+  for (i = 0; i < t->size; i++) {
+    b = atomic_load_explicit(&t->buckets[i], memory_order_relaxed);
+    while (b) {
+      next = atomic_load_explicit(&b->next, memory_order_relaxed);
+      reclaim_node(&b->retire);
+      b = next;
+    }
+  }
+  reclaim_table(&t->retire);
+  /* nobody else is in the table, so every bag is safe to empty */
+  for (i = 0; i < CHT_MAX_THREADS; i++) {
+    for (j = 0; j < 3; j++) {
+      ebr_free_bag(ht->records[i].bags[j]);
+    }
+  }
+  for (i = 0; i < ht->nstripes; i++) {
+    pthread_mutex_destroy(&ht->stripes[i].lock);
+  }
+  free(ht->stripes);
+  free(ht);
+}
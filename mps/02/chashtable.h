@@ -0,0 +1,40 @@
+#ifndef CHASHTABLE_T
+#define CHASHTABLE_T
+
+/* Concurrent variant of hashtable_t: same chained layout and ownership
+   rules (the table owns keys and values it's given), but safe to share
+   between threads.
+
+   Writers lock one stripe of buckets; readers take no locks at all and are
+   protected by epoch-based reclamation, so a node unlinked by cht_del or
+   replaced by cht_put is only freed once every reader that could have
+   seen it has moved on. Resizing takes every stripe, builds a new bucket
+   array and publishes it; readers already walking the old one finish
+   there undisturbed. */
+
+typedef struct chashtable chashtable_t;
+
+/* nstripes of 0 picks a default; max_load > 0 grows the table by doubling
+   once it holds more than max_load entries per bucket */
+chashtable_t *make_chashtable(unsigned long size, unsigned int nstripes,
+                              double max_load);
+void  cht_put(chashtable_t *ht, char *key, void *val);
+/* the returned value may be freed by a concurrent put/del as soon as the
+   call returns; to keep using it, bracket the call (and the use) with
+   cht_read_begin/cht_read_end */
+void *cht_get(chashtable_t *ht, char *key);
+void  cht_del(chashtable_t *ht, char *key);
+/* weakly consistent: sees every entry present for the whole walk, and
+   may or may not see ones added or removed during it */
+void  cht_iter(chashtable_t *ht, int (*f)(char *, void *));
+void  cht_rehash(chashtable_t *ht, unsigned long newsize);
+unsigned long cht_count(chashtable_t *ht);
+unsigned long cht_size(chashtable_t *ht);
+/* no other thread may be using the table */
+void  free_chashtable(chashtable_t *ht);
+
+/* read-side critical section; nests */
+void  cht_read_begin(chashtable_t *ht);
+void  cht_read_end(chashtable_t *ht);
+
+#endif
@@ -0,0 +1,195 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hashtable.h"
+#include "chashtable.h"
+#include "trace.h"
+
+/* Multithreaded trace replayer. Operations are dealt round-robin to the
+   worker threads, which replay their share against one shared table,
+   either a plain hashtable_t behind a global mutex (what callers do today)
+   or a chashtable_t. Rounds repeat the whole trace on the same table so
+   runs are long enough to time. 'i' directives are skipped. */
+
+typedef struct {
+  trace_t *trace;
+  int tid, nthreads, rounds, striped;
+  chashtable_t *cht;
+  hashtable_t *ht;
+  pthread_mutex_t *lock;
+  pthread_barrier_t *start;
+} worker_t;
+
+static void replay_striped(worker_t *w, trace_op_t *op) {
+  switch (op->type) {
+  case 'p':
+    cht_put(w->cht, strdup(op->key), strdup(op->val));
+    break;
+  case 'g':
+    cht_get(w->cht, op->key);
+    break;
+  case 'd':
+    cht_del(w->cht, op->key);
+    break;
+  case 'r':
+  case 'R':
+    cht_rehash(w->cht, op->n);
+    break;
+  }
+}
+
+static void replay_mutex(worker_t *w, trace_op_t *op) {
+  char *key, *val;
+  switch (op->type) {
+  case 'p':
+    key = strdup(op->key);
+    val = strdup(op->val);
+    pthread_mutex_lock(w->lock);
+    ht_put(w->ht, key, val);
+    pthread_mutex_unlock(w->lock);
+    break;
+  case 'g':
+    pthread_mutex_lock(w->lock);
+    ht_get(w->ht, op->key);
+    pthread_mutex_unlock(w->lock);
+    break;
+  case 'd':
+    pthread_mutex_lock(w->lock);
+    ht_del(w->ht, op->key);
+    pthread_mutex_unlock(w->lock);
+    break;
+  case 'r':
+  case 'R':
+    pthread_mutex_lock(w->lock);
+    ht_rehash(w->ht, op->n);
+    pthread_mutex_unlock(w->lock);
+    break;
+  }
+}
+
+static void *worker(void *arg) {
+  worker_t *w = arg;
+  trace_op_t op;
+  unsigned long i;
+  int r;
+  pthread_barrier_wait(w->start);
+  for (r = 0; r < w->rounds; r++) {
+    for (i = w->tid; i < w->trace->nops; i += w->nthreads) {
+      op = trace_op(w->trace, i);
+      if (w->striped) {
+        replay_striped(w, &op);
+      } else {
+        replay_mutex(w, &op);
+      }
+    }
+  }
+  return NULL;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* returns seconds taken by nthreads replaying the trace */
+static double run(trace_t *trace, int nthreads, int rounds, int striped) {
+  pthread_t *tids = malloc(sizeof(pthread_t) * nthreads);
+  worker_t *ws = malloc(sizeof(worker_t) * nthreads);
+  pthread_barrier_t start;
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  chashtable_t *cht = NULL;
+  hashtable_t *ht = NULL;
+  double t0, t1;
+  int i;
+
+  if (striped) {
+    cht = make_chashtable(trace->size, 0, 0);
+  } else {
+    ht = make_hashtable(trace->size);
+  }
+  pthread_barrier_init(&start, NULL, nthreads + 1);
+  for (i = 0; i < nthreads; i++) {
+    ws[i].trace = trace;
+    ws[i].tid = i;
+    ws[i].nthreads = nthreads;
+    ws[i].rounds = rounds;
+    ws[i].striped = striped;
+    ws[i].cht = cht;
+    ws[i].ht = ht;
+    ws[i].lock = &lock;
+    ws[i].start = &start;
+    pthread_create(&tids[i], NULL, worker, &ws[i]);
+  }
+  t0 = now();
+  pthread_barrier_wait(&start);
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  t1 = now();
+
+  pthread_barrier_destroy(&start);
+  if (striped) {
+    free_chashtable(cht);
+  } else {
+    free_hashtable(ht);
+  }
+  free(ws);
+  free(tids);
+  return t1 - t0;
+}
+
+static void usage(char *prog) {
+  printf("Usage: %s [-t MAX_THREADS] [-n ROUNDS] TRACEFILE_NAME\n", prog);
+  printf("  -t  largest thread count to try (default: online cores)\n");
+  printf("  -n  times each run replays the trace (default 20)\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  int c, max_threads = sysconf(_SC_NPROCESSORS_ONLN), rounds = 20;
+  int nthreads, striped;
+  double secs, base[2] = { 0, 0 }, ops;
+  trace_t *trace;
+
+  while ((c = getopt(argc, argv, "t:n:")) != -1) {
+    switch (c) {
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'n':
+      rounds = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind >= argc || max_threads < 1 || rounds < 1) {
+    usage(argv[0]);
+  }
+  if ((trace = load_trace(argv[optind])) == NULL) {
+    exit(1);
+  }
+
+  ops = (double)trace->nops * rounds;
+  printf("%-8s %-8s %10s %8s\n", "threads", "table", "Mops/s", "speedup");
+  /* 1, 2, 4, ... and always the maximum itself */
+  for (nthreads = 1; ; nthreads = nthreads * 2 < max_threads ? nthreads * 2 : max_threads) {
+    for (striped = 0; striped < 2; striped++) {
+      secs = run(trace, nthreads, rounds, striped);
+      if (nthreads == 1) {
+        base[striped] = secs;
+      }
+      printf("%-8d %-8s %10.2f %8.2f\n", nthreads, striped ? "striped" : "mutex",
+             ops / secs / 1e6, base[striped] / secs);
+    }
+    if (nthreads == max_threads) {
+      break;
+    }
+  }
+  free_trace(trace);
+  return 0;
+}
@@ -18,9 +18,20 @@ hashtable_t *make_hashtable(unsigned long size) {
   return NULL;
 }
 
+hashtable_t *make_hashtable_backend(unsigned long size, ht_backend_t backend) {
+  return make_hashtable(size);
+}
+
+hashtable_t *make_hashtable_opts(const ht_opts_t *opts) {
+  return make_hashtable(opts->size);
+}
+
 void ht_put(hashtable_t *ht, char *key, void *val) {
 }
 
+void ht_put_copy(hashtable_t *ht, const char *key, const void *val, size_t vallen) {
+}
+
 void *ht_get(hashtable_t *ht, char *key) {
   return NULL;
 }
@@ -28,11 +39,53 @@ void *ht_get(hashtable_t *ht, char *key) {
 void ht_del(hashtable_t *ht, char *key) {
 }
 
+void ht_put_n(hashtable_t *ht, char *key, size_t keylen, void *val) {
+}
+
+void *ht_get_n(hashtable_t *ht, const char *key, size_t keylen) {
+  return NULL;
+}
+
+void ht_del_n(hashtable_t *ht, const char *key, size_t keylen) {
+}
+
+void ht_put_hashed(hashtable_t *ht, char *key, size_t keylen, void *val, unsigned long h) {
+}
+
+void *ht_get_hashed(hashtable_t *ht, const char *key, size_t keylen, unsigned long h) {
+  return NULL;
+}
+
+void ht_del_hashed(hashtable_t *ht, const char *key, size_t keylen, unsigned long h) {
+}
+
 void ht_iter(hashtable_t *ht, int (*f)(char *, void *)) {
 }
 
+void ht_iter_n(hashtable_t *ht, int (*f)(char *, size_t, void *)) {
+}
+
 void ht_rehash(hashtable_t *ht, unsigned long newsize) {
 }
 
+void ht_rehash_incremental(hashtable_t *ht, unsigned long newsize) {
+}
+
 void free_hashtable(hashtable_t *ht) {
 }
+
+unsigned long ht_probe_len(hashtable_t *ht, unsigned long idx) {
+  return 0;
+}
+
+void ht_stats(hashtable_t *ht, ht_stats_t *out) {
+  memset(out, 0, sizeof(*out));
+}
+
+int ht_save(hashtable_t *ht, const char *path) {
+  return -1;
+}
+
+hashtable_t *ht_open_mapped(const char *path) {
+  return NULL;
+}
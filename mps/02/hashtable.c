@@ -1,6 +1,18 @@
+#include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include "hashtable.h"
+#include "ht_internal.h"
+
+static void chained_store(hashtable_t *ht, char *key, size_t len, void *val,
+                          unsigned char flags, unsigned long h);
+static struct ht_cache *cache_create(const ht_opts_t *opts);
+static void cache_trim(hashtable_t *ht);
+
+/* keys hashed and prefetched together by ht_get_many/ht_put_many; enough
+   to cover memory latency without the early fetches evicting each other */
+#define HT_BATCH 16
 
 /* Daniel J. Bernstein's "times 33" string hash function, from comp.lang.C;
    See https://groups.google.com/forum/#!topic/comp.lang.c/lSKWXiuNOAk */
@@ -15,127 +27,1194 @@ unsigned long hash(char *str) {
 }
 
 hashtable_t *make_hashtable(unsigned long size) {
-  hashtable_t *ht = malloc(sizeof(hashtable_t));
-  ht->size = size;
-  ht->buckets = calloc(sizeof(bucket_t *), size);
-  /* pointers were set to null by calloc */
+  return make_hashtable_backend(size, HT_CHAINED);
+}
+
+hashtable_t *make_hashtable_backend(unsigned long size, ht_backend_t backend) {
+  ht_opts_t opts = { 0 };
+  opts.size = size;
+  opts.backend = backend;
+  return make_hashtable_opts(&opts);
+}
+
+hashtable_t *make_hashtable_opts(const ht_opts_t *opts) {
+  hashtable_t *ht = calloc(1, sizeof(hashtable_t));
+  ht->backend = opts->backend;
+  ht->huge_pages = opts->huge_pages;
+  switch (opts->backend) {
+  case HT_ROBINHOOD:
+    ht->ops = &robinhood_ops;
+    rh_init(ht, opts->size);
+    break;
+  case HT_SWISS:
+    ht->ops = &swiss_ops;
+    sw_init(ht, opts->size);
+    break;
+  case HT_COMPACT:
+    ht->ops = &compact_ops;
+    cp_init(ht, opts->size);
+    break;
+  default:
+    ht->backend = HT_CHAINED;
+    ht->ops = &chained_ops;
+    ht->size = opts->size;
+    ht->buckets = ht_array_alloc(sizeof(bucket_t *) * opts->size, ht->huge_pages);
+    /* pointers were set to null by ht_array_alloc */
+    if (opts->capacity) {
+      ht->cache = cache_create(opts);
+    } else if (opts->arena) {
+      ht->arena = arena_create(ht->huge_pages);
+    }
+    break;
+  }
+  ht->min_size = ht->size;
+  ht->max_load = opts->max_load;
+  ht->min_load = opts->min_load;
+  /* a shrink must leave the table well under max_load, or we'd thrash */
+  if (ht->max_load > 0 && ht->min_load > ht->max_load / 4) {
+    ht->min_load = ht->max_load / 4;
+  }
+  ht->incremental = opts->incremental;
+  ht->hashfn = opts->hash ? opts->hash : ht_hash_djb2;
+  if (opts->bloom) {
+    ht->bloom = bloom_create(ht->size);
+  }
   return ht;
 }
 
+/* grows or shrinks by a factor of two once the load factor leaves
+   [min_load, max_load]; never while an incremental resize is running */
+static void ht_autoresize(hashtable_t *ht) {
+  unsigned long newsize;
+  if (ht->old_buckets) {
+    return;
+  }
+  if (ht->max_load > 0 && ht->count > ht->max_load * ht->size) {
+    newsize = ht->size * 2;
+  } else if (ht->min_load > 0 && ht->count < ht->min_load * ht->size
+             && ht->size / 2 >= ht->min_size) {
+    newsize = ht->size / 2;
+  } else {
+    return;
+  }
+  if (ht->incremental) {
+    ht_rehash_incremental(ht, newsize);
+  } else {
+    ht_rehash(ht, newsize);
+  }
+}
+
+static int bloom_visit(void *ctx, char *key, size_t keylen, void *val) {
+  hashtable_t *ht = ctx;
+  bloom_add(ht->bloom, ht->hashfn(key, keylen));
+  return 1;
+}
+
+/* a fresh filter of just the live keys, with room for as many again */
+static void bloom_rebuild(hashtable_t *ht) {
+  bloom_destroy(ht->bloom);
+  ht->bloom = bloom_create(2 * ht->count > ht->min_size ? 2 * ht->count : ht->min_size);
+  ht->ops->iter(ht, bloom_visit, ht);
+}
+
+/* The filter is rebuilt from the live keys once more have gone in than it
+   was sized for, and once deleted keys, which keep passing it, number a
+   quarter of the live keys and slots together (BLOOM_SLACK more, so a
+   small table isn't rebuilt on every delete). A rebuild walks every slot,
+   so either way the puts or deletes since the last one are in proportion
+   to what the next one costs, even in a table emptied without shrinking. */
+#define BLOOM_SLACK 64
+
+static void bloom_put(hashtable_t *ht, unsigned long h, int inserted) {
+  bloom_add(ht->bloom, h);
+  if (inserted && ++ht->bloom->added > ht->bloom->capacity) {
+    bloom_rebuild(ht);
+  }
+}
+
+static void bloom_removed(hashtable_t *ht, unsigned long n) {
+  ht->bloom->removed += n;
+  if (ht->bloom->removed > (ht->count + ht->size) / 4 + BLOOM_SLACK) {
+    bloom_rebuild(ht);
+  }
+}
+
+/* the backend's put and get, plus the counts only the public layer can
+   tell: an insert is the one that grows the table */
+static void counted_put(hashtable_t *ht, char *key, size_t len, void *val,
+                        unsigned long h) {
+  unsigned long n = ht->count, evicted = ht->stats.evictions;
+  int inserted;
+  ht->ops->put(ht, key, len, val, h);
+  inserted = ht->count != n;
+  ht->stats.puts++;
+  ht->stats.updates += !inserted;
+  if (ht->cache) {
+    cache_trim(ht);
+  }
+  if (ht->bloom) {
+    bloom_put(ht, h, inserted);
+    if (ht->stats.evictions != evicted) {
+      bloom_removed(ht, ht->stats.evictions - evicted);
+    }
+  }
+}
+
+static void *counted_get(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+  void *val;
+  if (ht->bloom && !bloom_maybe(ht->bloom, h)) {
+    ht->stats.bloom_rejects++;
+    val = NULL;
+  } else {
+    val = ht->ops->get(ht, key, len, h);
+    ht->stats.bloom_false_pos += ht->bloom && !val;
+  }
+  ht->stats.gets++;
+  if (val) {
+    ht->stats.hits++;
+  } else {
+    ht->stats.misses++;
+  }
+  return val;
+}
+
+void ht_put_hashed(hashtable_t *ht, char *key, size_t keylen, void *val, unsigned long h) {
+  counted_put(ht, key, keylen, val, h);
+  ht_autoresize(ht);
+}
+
+void *ht_get_hashed(hashtable_t *ht, const char *key, size_t keylen, unsigned long h) {
+  return counted_get(ht, key, keylen, h);
+}
+
+void ht_del_hashed(hashtable_t *ht, const char *key, size_t keylen, unsigned long h) {
+  unsigned long n = ht->count;
+  ht->ops->del(ht, key, keylen, h);
+  ht->stats.deletes++;
+  if (ht->bloom && ht->count != n) {
+    bloom_removed(ht, 1);
+  }
+  ht_autoresize(ht);
+}
+
+void ht_put_n(hashtable_t *ht, char *key, size_t keylen, void *val) {
+  ht_put_hashed(ht, key, keylen, val, ht->hashfn(key, keylen));
+}
+
+void *ht_get_n(hashtable_t *ht, const char *key, size_t keylen) {
+  return ht_get_hashed(ht, key, keylen, ht->hashfn(key, keylen));
+}
+
+void ht_del_n(hashtable_t *ht, const char *key, size_t keylen) {
+  ht_del_hashed(ht, key, keylen, ht->hashfn(key, keylen));
+}
+
 void ht_put(hashtable_t *ht, char *key, void *val) {
-  unsigned int idx = hash(key) % ht->size;
-  bucket_t *cur_b = ht->buckets[idx];
+  ht_put_n(ht, key, strlen(key), val);
+}
+
+void *ht_get(hashtable_t *ht, char *key) {
+  return ht_get_n(ht, key, strlen(key));
+}
+
+void ht_del(hashtable_t *ht, char *key) {
+  ht_del_n(ht, key, strlen(key));
+}
+
+/* hashes keys[0..n) and prefetches for them; n <= HT_BATCH */
+static void hash_batch(hashtable_t *ht, char **keys, int n, size_t *lens,
+                       unsigned long *hashes) {
+  int i;
+  for (i = 0; i < n; i++) {
+    lens[i] = strlen(keys[i]);
+    hashes[i] = ht->hashfn(keys[i], lens[i]);
+  }
+  if (ht->ops->prefetch) {
+    ht->ops->prefetch(ht, hashes, n);
+  }
+}
+
+void ht_get_many(hashtable_t *ht, char **keys, unsigned long n, void **vals) {
+  unsigned long hashes[HT_BATCH], base;
+  size_t lens[HT_BATCH];
+  int i, m;
+  for (base = 0; base < n; base += m) {
+    m = n - base < HT_BATCH ? n - base : HT_BATCH;
+    hash_batch(ht, keys + base, m, lens, hashes);
+    for (i = 0; i < m; i++) {
+      vals[base + i] = counted_get(ht, keys[base + i], lens[i], hashes[i]);
+    }
+  }
+}
+
+void ht_put_many(hashtable_t *ht, char **keys, void **vals, unsigned long n) {
+  unsigned long hashes[HT_BATCH], base;
+  size_t lens[HT_BATCH];
+  int i, m;
+  for (base = 0; base < n; base += m) {
+    m = n - base < HT_BATCH ? n - base : HT_BATCH;
+    hash_batch(ht, keys + base, m, lens, hashes);
+    for (i = 0; i < m; i++) {
+      /* a resize here only wastes the rest of the batch's prefetches */
+      counted_put(ht, keys[base + i], lens[i], vals[base + i], hashes[i]);
+      ht_autoresize(ht);
+    }
+  }
+}
+
+/* the public callbacks, called through ht_visit_fn; ctx points at one */
+static int visit_str(void *ctx, char *key, size_t keylen, void *val) {
+  return (*(int (**)(char *, void *))ctx)(key, val);
+}
+
+static int visit_n(void *ctx, char *key, size_t keylen, void *val) {
+  return (*(int (**)(char *, size_t, void *))ctx)(key, keylen, val);
+}
+
+void ht_iter(hashtable_t *ht, int (*f)(char *, void *)) {
+  ht->ops->iter(ht, visit_str, &f);
+}
+
+void ht_iter_n(hashtable_t *ht, int (*f)(char *, size_t, void *)) {
+  ht->ops->iter(ht, visit_n, &f);
+}
+
+/* resizes rebuild the filter too: it's a pass over every key either way */
+void ht_rehash(hashtable_t *ht, unsigned long newsize) {
+  ht->ops->rehash(ht, newsize);
+  if (ht->bloom) {
+    bloom_rebuild(ht);
+  }
+}
+
+void free_hashtable(hashtable_t *ht) {
+  bloom_destroy(ht->bloom);
+  ht->ops->destroy(ht);
+}
+
+void ht_rehash_incremental(hashtable_t *ht, unsigned long newsize) {
+  ht->ops->rehash_incremental(ht, newsize);
+  if (ht->bloom) {
+    bloom_rebuild(ht);
+  }
+}
+
+unsigned long ht_probe_len(hashtable_t *ht, unsigned long idx) {
+  return ht->ops->probe_len ? ht->ops->probe_len(ht, idx) : 0;
+}
+
+void ht_stats(hashtable_t *ht, ht_stats_t *out) {
+  *out = ht->stats;
+  /* a mapped table resizes nothing itself; its overlay does */
+  if (ht->overlay) {
+    out->rehashes += ht->overlay->stats.rehashes;
+  }
+}
+
+void ht_put_copy(hashtable_t *ht, const char *key, const void *val, size_t vallen) {
+  size_t keylen = strlen(key);
+  unsigned long n = ht->count, h;
+  char *k = (char *)key;
+  void *v;
+  if (!ht->arena) {
+    /* no arena to copy into; hand the table heap copies instead */
+    v = malloc(vallen);
+    memcpy(v, val, vallen);
+    ht_put(ht, strdup(key), v);
+    return;
+  }
+  /* a short key is copied into its bucket, so it needs no arena copy */
+  if (keylen > HT_INLINE_KEY) {
+    k = arena_copy(ht->arena, key, keylen + 1);
+  }
+  v = arena_copy(ht->arena, val, vallen);
+  h = ht->hashfn(k, keylen);
+  chained_store(ht, k, keylen, v, B_ARENA, h);
+  ht->stats.puts++;
+  ht->stats.updates += ht->count == n;
+  if (ht->bloom) {
+    bloom_put(ht, h, ht->count != n);
+  }
+  ht_autoresize(ht);
+}
+
+/* separate chaining backend */
+
+/* Incremental rehashing keeps the old bucket array around and moves a few
+   of its chains to the new array on every operation. Old buckets below
+   migrate_pos have been emptied, so a key whose old index is below it lives
+   in the new array and everything else is still in the old one. */
+#define MIGRATE_CHAINS 1    /* non-empty chains moved per operation */
+#define MIGRATE_SCAN   16   /* empty old buckets skipped per operation */
+
+static void free_entry(hashtable_t *ht, bucket_t *b) {
+  if (!(b->flags & B_ARENA)) {
+    if (!(b->flags & B_INLINE)) {
+      free(b->key_ptr);
+    }
+    free(b->val);
+    ht->owned--;
+  }
+}
+
+/* stores key in b, inline if it's short enough. An inlined key the table
+   owns is freed right away, so callers never see the difference. */
+static void set_key(bucket_t *b, char *key, size_t len, unsigned char flags) {
+  if (len > HT_INLINE_KEY) {
+    b->key_ptr = key;
+    b->key_len = len;
+    b->flags = flags;
+    return;
+  }
+  memcpy(b->key_buf, key, len);
+  b->key_buf[len] = '\0';
+  b->key_buf[HT_INLINE_KEY] = HT_INLINE_KEY - len;
+  b->flags = flags | B_INLINE;
+  if (!(flags & B_ARENA)) {
+    free(key);
+  }
+}
+
+/* Cache mode. Every bucket is followed by its links in a ring of all the
+   table's entries, closed by the cache's sentinel. LRU keeps the ring in
+   recency order, newest just after the sentinel, and evicts from the
+   other end. CLOCK links an entry in once, just behind the hand, and a
+   hit only sets B_REF in the bucket the lookup already has in cache; to
+   evict, the hand walks backwards round the ring clearing bits until it
+   meets an entry without one. */
+
+typedef struct cache_bucket cache_bucket_t;
+struct cache_bucket {
+  bucket_t b;               /* must be first */
+  cache_bucket_t *prev, *next;
+};
+
+#define CB(b) ((cache_bucket_t *)(b))
+
+struct ht_cache {
+  unsigned long capacity;
+  ht_evict_t policy;
+  ht_evict_fn on_evict;
+  void *ctx;
+  cache_bucket_t ring;      /* sentinel */
+  cache_bucket_t *hand;     /* CLOCK: the sweep looks at hand->prev next */
+};
+
+static struct ht_cache *cache_create(const ht_opts_t *opts) {
+  struct ht_cache *c = calloc(1, sizeof(struct ht_cache));
+  c->capacity = opts->capacity;
+  c->policy = opts->evict;
+  c->on_evict = opts->on_evict;
+  c->ctx = opts->evict_ctx;
+  c->ring.prev = c->ring.next = &c->ring;
+  c->hand = &c->ring;
+  return c;
+}
+
+static void ring_link_after(cache_bucket_t *at, cache_bucket_t *cb) {
+  cb->prev = at;
+  cb->next = at->next;
+  at->next->prev = cb;
+  at->next = cb;
+}
+
+static void ring_unlink(cache_bucket_t *cb) {
+  cb->prev->next = cb->next;
+  cb->next->prev = cb->prev;
+}
+
+/* a new entry; CLOCK puts it where the hand will reach it last */
+static void cache_link(hashtable_t *ht, bucket_t *b) {
+  struct ht_cache *c = ht->cache;
+  ring_link_after(c->policy == HT_EVICT_CLOCK ? c->hand : &c->ring, CB(b));
+}
+
+/* a get of b, or a put to it */
+static void cache_touch(hashtable_t *ht, bucket_t *b) {
+  struct ht_cache *c = ht->cache;
+  if (c->policy == HT_EVICT_CLOCK) {
+    b->flags |= B_REF;
+  } else if (c->ring.next != CB(b)) {
+    ring_unlink(CB(b));
+    ring_link_after(&c->ring, CB(b));
+  }
+}
+
+static void cache_unlink(hashtable_t *ht, bucket_t *b) {
+  if (ht->cache->hand == CB(b)) {
+    ht->cache->hand = CB(b)->next;
+  }
+  ring_unlink(CB(b));
+}
+
+/* the ring isn't empty, or there'd be nothing to evict */
+static bucket_t *cache_victim(struct ht_cache *c) {
+  cache_bucket_t *cb;
+  if (c->policy == HT_EVICT_LRU) {
+    return &c->ring.prev->b;
+  }
+  for (;;) {
+    cb = c->hand->prev;
+    if (cb != &c->ring && !(cb->b.flags & B_REF)) {
+      return &cb->b;
+    }
+    cb->b.flags &= ~B_REF;
+    c->hand = cb;
+  }
+}
+
+/* a cache table's buckets carry their ring links */
+static bucket_t *alloc_bucket(hashtable_t *ht) {
+  if (ht->cache) {
+    return malloc(sizeof(cache_bucket_t));
+  }
+  return ht->arena ? arena_bucket(ht->arena) : malloc(sizeof(bucket_t));
+}
+
+static void free_bucket(hashtable_t *ht, bucket_t *b) {
+  if (ht->arena) {
+    arena_bucket_free(ht->arena, b);
+  } else {
+    free(b);
+  }
+}
+
+/* Snapshots. Each ht_snapshot starts a new generation. A chain whose
+   chain_gen is behind the current one may be shared with a snapshot, so
+   before anything in it changes it's copied and the copy stamped with the
+   current gen; a put of a new key just prepends, which leaves the shared
+   nodes alone. Replaced nodes, and keys and values the table lets go of
+   while snapshots are about, are retired with the gen they left in and
+   freed once no snapshot older than that is left. */
+
+typedef struct {
+  bucket_t *node;       /* each freed if not NULL */
+  char *key;
+  void *val;
+  unsigned long gen;
+} retired_t;
+
+struct ht_cow {
+  unsigned long gen;
+  unsigned long *chain_gen;   /* one per bucket */
+  hashtable_t *snaps;         /* live snapshots, newest first */
+  retired_t *retired;         /* oldest first, so in gen order */
+  unsigned long nretired, retired_cap;
+};
+
+static int snapshots_live(hashtable_t *ht) {
+  return ht->cow && ht->cow->snaps;
+}
+
+/* a snapshot may see the chain key h lives in; never mid-migration, as
+   taking a snapshot finishes it and resizes never start one while there
+   are snapshots */
+static int chain_shared(hashtable_t *ht, unsigned long h) {
+  return snapshots_live(ht) && ht->cow->chain_gen[h % ht->size] != ht->cow->gen;
+}
+
+static void retire(hashtable_t *ht, bucket_t *node, char *key, void *val) {
+  struct ht_cow *cow = ht->cow;
+  if (cow->nretired == cow->retired_cap) {
+    cow->retired_cap = cow->retired_cap ? cow->retired_cap * 2 : 64;
+    cow->retired = realloc(cow->retired, sizeof(retired_t) * cow->retired_cap);
+  }
+  cow->retired[cow->nretired].node = node;
+  cow->retired[cow->nretired].key = key;
+  cow->retired[cow->nretired].val = val;
+  cow->retired[cow->nretired].gen = cow->gen;
+  cow->nretired++;
+}
+
+static void free_retired(hashtable_t *ht, retired_t *r) {
+  if (r->node) {
+    free_bucket(ht, r->node);
+  }
+  free(r->key);
+  free(r->val);
+}
+
+/* free_entry, unless a snapshot may still hand out the key or value */
+static void drop_entry(hashtable_t *ht, bucket_t *b) {
+  if (snapshots_live(ht) && !(b->flags & B_ARENA)) {
+    retire(ht, NULL, (b->flags & B_INLINE) ? NULL : b->key_ptr, b->val);
+    ht->owned--;
+    return;
+  }
+  free_entry(ht, b);
+}
+
+/* gives the table its own copy of the chain at head, returning the copy
+   of b; the old nodes are retired as they stand */
+static bucket_t *unshare_chain(hashtable_t *ht, bucket_t **head, unsigned long h,
+                               bucket_t *b) {
+  bucket_t *cur_b = *head, *copy, *b_copy = NULL, **tail = head;
+  while (cur_b) {
+    copy = alloc_bucket(ht);
+    *copy = *cur_b;
+    if (cur_b == b) {
+      b_copy = copy;
+    }
+    *tail = copy;
+    tail = &copy->next;
+    retire(ht, cur_b, NULL, NULL);
+    cur_b = cur_b->next;
+  }
+  *tail = NULL;
+  ht->cow->chain_gen[h % ht->size] = ht->cow->gen;
+  return b_copy;
+}
+
+/* chain_gen follows the bucket array's size; gen 0 is behind every
+   snapshot, so a fresh array counts as shared */
+static void cow_resize(hashtable_t *ht, unsigned long newsize, unsigned long gen) {
+  unsigned long i;
+  free(ht->cow->chain_gen);
+  ht->cow->chain_gen = malloc(sizeof(unsigned long) * newsize);
+  for (i = 0; i < newsize; i++) {
+    ht->cow->chain_gen[i] = gen;
+  }
+}
+
+static void free_chains(hashtable_t *ht, bucket_t **buckets, unsigned long from, unsigned long to) {
+  unsigned long i;
+  bucket_t *b;
+  bucket_t *prev_b;
+  /* an arena table whose entries all live in the arena has nothing to
+     walk; dropping the slabs frees everything */
+  if (ht->arena && ht->owned == 0) {
+    return;
+  }
+  for (i = from; i < to; i++){
+    b = buckets[i];
+    prev_b = buckets[i];
+    while (b){
+      prev_b = b;
+      b = b->next;
+      free_entry(ht, prev_b);
+      if (!ht->arena) {
+        free(prev_b);
+      }
+    }
+  }
+}
+
+/* relinks one old chain into the new array; no allocation, and the
+   stored hashes mean no key is hashed again */
+static void migrate_chain(hashtable_t *ht, unsigned long old_idx) {
+  bucket_t *b = ht->old_buckets[old_idx];
+  bucket_t *next_b;
+  unsigned long idx;
+  while (b) {
+    next_b = b->next;
+    idx = b->hash % ht->size;
+    b->next = ht->buckets[idx];
+    ht->buckets[idx] = b;
+    b = next_b;
+  }
+  ht->old_buckets[old_idx] = NULL;
+}
+
+static void migrate_done(hashtable_t *ht) {
+  ht_array_free(ht->old_buckets);
+  ht->old_buckets = NULL;
+  ht->old_size = 0;
+  ht->migrate_pos = 0;
+}
+
+static void migrate_step(hashtable_t *ht) {
+  unsigned long chains = MIGRATE_CHAINS, scan = MIGRATE_SCAN;
+  while (ht->migrate_pos < ht->old_size && chains > 0 && scan > 0) {
+    if (ht->old_buckets[ht->migrate_pos]) {
+      migrate_chain(ht, ht->migrate_pos);
+      chains--;
+    } else {
+      scan--;
+    }
+    ht->migrate_pos++;
+  }
+  if (ht->migrate_pos == ht->old_size) {
+    migrate_done(ht);
+  }
+}
+
+static void migrate_all(hashtable_t *ht) {
+  while (ht->migrate_pos < ht->old_size) {
+    migrate_chain(ht, ht->migrate_pos++);
+  }
+  migrate_done(ht);
+}
+
+/* finds the chain a key belongs to, moving some of a pending rehash along */
+static bucket_t **chain_head(hashtable_t *ht, unsigned long h) {
+  unsigned long old_idx;
+  if (ht->old_buckets) {
+    migrate_step(ht);
+  }
+  if (ht->old_buckets) {
+    old_idx = h % ht->old_size;
+    if (old_idx >= ht->migrate_pos) {
+      return &ht->old_buckets[old_idx];
+    }
+  }
+  return &ht->buckets[h % ht->size];
+}
+
+/* evicts until the table is back down to capacity */
+static void cache_trim(hashtable_t *ht) {
+  struct ht_cache *c = ht->cache;
+  bucket_t *b, **pp;
+  while (ht->count > c->capacity) {
+    b = cache_victim(c);
+    for (pp = chain_head(ht, b->hash); *pp != b; pp = &(*pp)->next)
+      ;
+    *pp = b->next;
+    cache_unlink(ht, b);
+    if (c->on_evict) {
+      c->on_evict(c->ctx, bucket_key(b), bucket_keylen(b), b->val);
+    } else {
+      free(b->val);
+    }
+    /* cache tables have no arena, so the table owns every key */
+    if (!(b->flags & B_INLINE)) {
+      free(b->key_ptr);
+    }
+    ht->owned--;
+    free_bucket(ht, b);
+    ht->count--;
+    ht->stats.evictions++;
+  }
+}
+
+/* inserts or updates; flags say who owns key and val. A key the table
+   owns may be freed before this returns; see set_key */
+static void chained_store(hashtable_t *ht, char *key, size_t len, void *val,
+                          unsigned char flags, unsigned long h) {
+  bucket_t **head = chain_head(ht, h);
+  bucket_t *cur_b = *head;
+  unsigned long steps = 0;
   while (cur_b){
-    if (strcmp(cur_b->key, key) == 0){
+    steps++;
+    /* the stored hash settles nearly every mismatch without a memcmp */
+    if (cur_b->hash == h && bucket_keylen(cur_b) == len
+        && memcmp(bucket_key(cur_b), key, len) == 0){
+      ht_note_probe(ht, steps);
+      if (chain_shared(ht, h)) {
+        cur_b = unshare_chain(ht, head, h, cur_b);
+      }
       /* update entry */
-      free(cur_b->key);
-      free(cur_b->val);
+      drop_entry(ht, cur_b);
       cur_b->val = val;
-      cur_b->key = key;
+      set_key(cur_b, key, len, flags);
+      if (!(flags & B_ARENA)) {
+        ht->owned++;
+      }
+      if (ht->cache) {
+        cache_touch(ht, cur_b);
+      }
       return;
     }
     cur_b = cur_b->next;
   }
+  ht_note_probe(ht, steps);
   /* didn't update, so make a new bucket*/
-  bucket_t *new_b = malloc(sizeof(bucket_t));
-  new_b->key = key;
+  bucket_t *new_b = alloc_bucket(ht);
+  new_b->hash = h;
   new_b->val = val;
+  set_key(new_b, key, len, flags);
   /* prepend */
-  new_b->next = ht->buckets[idx];
-  ht->buckets[idx] = new_b;
+  new_b->next = *head;
+  *head = new_b;
+  if (ht->cache) {
+    cache_link(ht, new_b);
+  }
+  ht->count++;
+  if (!(flags & B_ARENA)) {
+    ht->owned++;
+  }
 }
 
-void *ht_get(hashtable_t *ht, char *key) {
-  unsigned int idx = hash(key) % ht->size;
-  bucket_t *b = ht->buckets[idx];
+static void chained_put(hashtable_t *ht, char *key, size_t len, void *val,
+                        unsigned long h) {
+  chained_store(ht, key, len, val, 0, h);
+}
+
+bucket_t *chained_find(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+  bucket_t *b = *chain_head(ht, h);
+  unsigned long steps = 0;
   while (b) {
-    if (strcmp(b->key, key) == 0) {
-      return b->val;
+    steps++;
+    if (b->hash == h && bucket_keylen(b) == len
+        && memcmp(bucket_key(b), key, len) == 0) {
+      break;
     }
     b = b->next;
   }
-  return NULL;
+  ht_note_probe(ht, steps);
+  return b;
 }
 
-void ht_iter(hashtable_t *ht, int (*f)(char *, void *)) {
+static void *chained_get(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+  bucket_t *b = chained_find(ht, key, len, h);
+  if (b && ht->cache) {
+    cache_touch(ht, b);
+  }
+  return b ? b->val : NULL;
+}
+
+static int iter_chains(bucket_t **buckets, unsigned long from, unsigned long to,
+                       ht_visit_fn visit, void *ctx) {
   bucket_t *b;
   unsigned long i;
-  for (i=0; i<ht->size; i++) {
-    b = ht->buckets[i];
+  for (i=from; i<to; i++) {
+    b = buckets[i];
     while (b) {
-      if (!f(b->key, b->val)) {
-        return ; // abort iteration
+      if (!visit(ctx, bucket_key(b), bucket_keylen(b), b->val)) {
+        return 0; // abort iteration
       }
       b = b->next;
     }
   }
+  return 1;
 }
 
-void free_hashtable(hashtable_t *ht) {
+static void chained_iter(hashtable_t *ht, ht_visit_fn visit, void *ctx) {
+  if (iter_chains(ht->buckets, 0, ht->size, visit, ctx) && ht->old_buckets) {
+    iter_chains(ht->old_buckets, ht->migrate_pos, ht->old_size, visit, ctx);
+  }
+}
+
+static void chained_destroy(hashtable_t *ht) {
   unsigned long i;
-  bucket_t *b;
-  bucket_t *prev_b;
-  for (i = 0; i < ht->size; i++){
-    b = ht->buckets[i];
-    prev_b = ht->buckets[i];
-    while (b){
-      prev_b = b;
-      b = b->next;
-      free(prev_b->key);
-      free(prev_b->val);
-      free(prev_b);
+  free_chains(ht, ht->buckets, 0, ht->size);
+  if (ht->old_buckets) {
+    free_chains(ht, ht->old_buckets, ht->migrate_pos, ht->old_size);
+    ht_array_free(ht->old_buckets);
+  }
+  if (ht->cow) {
+    for (i = 0; i < ht->cow->nretired; i++) {
+      free_retired(ht, &ht->cow->retired[i]);
     }
+    free(ht->cow->retired);
+    free(ht->cow->chain_gen);
+    free(ht->cow);
   }
-  free(ht->buckets);
+  if (ht->arena) {
+    arena_destroy(ht->arena);
+  }
+  free(ht->cache);
+  ht_array_free(ht->buckets);
   free(ht);
 }
 
-void ht_del(hashtable_t *ht, char *key) {
-  unsigned int idx = hash(key) % ht->size;
-  bucket_t *b = ht->buckets[idx];
-  bucket_t *prev_b = ht->buckets[idx];
+static void chained_del(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+  bucket_t **head = chain_head(ht, h);
+  bucket_t *b = *head;
+  bucket_t *prev_b = *head;
+  unsigned long steps = 0;
   while (b){
-    if (strcmp(b->key, key) == 0){
-      free(b->key);
-      free(b->val);
+    steps++;
+    if (b->hash == h && bucket_keylen(b) == len
+        && memcmp(bucket_key(b), key, len) == 0){
+      ht_note_probe(ht, steps);
+      if (chain_shared(ht, h)) {
+        b = unshare_chain(ht, head, h, b);
+        prev_b = *head;
+        while (prev_b != b && prev_b->next != b) {
+          prev_b = prev_b->next;
+        }
+      }
+      drop_entry(ht, b);
       /*special case for head element */
-      if (b == ht->buckets[idx]){
-	ht->buckets[idx] = b->next;
+      if (b == *head){
+	*head = b->next;
       }
       else {
 	/*fix the list by making prev_b point to b's next */
 	prev_b->next = b->next;
       }
-      free(b);
+      if (ht->cache) {
+        cache_unlink(ht, b);
+      }
+      free_bucket(ht, b);
+      ht->count--;
       return;
     }
     prev_b = b;
     b = b->next;
   }
+  ht_note_probe(ht, steps);
 }
 
-void ht_rehash(hashtable_t *ht, unsigned long newsize) {
-  hashtable_t *new_ht = make_hashtable(newsize);
-  /* there's some contention about free(NULL); standards-wise, free(NULL) is NOP but I use it here so I don't have to repeat the entirety of free_hashtable. */
-  /* put old keys into new-sized bucket */
-  unsigned long i;
-  bucket_t *b;
-  for (i=0; i<ht->size; i++) {
-    b = ht->buckets[i];
-    while (b){
-      ht_put(new_ht, b->key, b->val);
-      b->val = NULL;
-      b->key = NULL;
-      b = b->next;
+/* relinking would rewrite chains snapshots are reading, so while there
+   are any, a resize copies the shared chains' nodes and retires the
+   originals; only chains the table already has to itself are relinked */
+static void copy_rehash(hashtable_t *ht, unsigned long newsize) {
+  bucket_t **buckets = ht_array_alloc(sizeof(bucket_t *) * newsize, ht->huge_pages);
+  bucket_t *b, *next_b, *copy;
+  unsigned long i, idx;
+  int shared;
+  for (i = 0; i < ht->size; i++) {
+    shared = ht->cow->chain_gen[i] != ht->cow->gen;
+    for (b = ht->buckets[i]; b; b = next_b) {
+      next_b = b->next;
+      copy = b;
+      if (shared) {
+        copy = alloc_bucket(ht);
+        *copy = *b;
+        retire(ht, b, NULL, NULL);
+      }
+      idx = b->hash % newsize;
+      copy->next = buckets[idx];
+      buckets[idx] = copy;
+    }
+  }
+  ht_array_free(ht->buckets);
+  ht->buckets = buckets;
+  ht->size = newsize;
+  cow_resize(ht, newsize, ht->cow->gen);
+}
+
+static void chained_rehash_incremental(hashtable_t *ht, unsigned long newsize) {
+  ht->stats.rehashes++;
+  if (ht->old_buckets) {
+    migrate_all(ht);
+  }
+  if (snapshots_live(ht)) {
+    copy_rehash(ht, newsize);
+    return;
+  }
+  ht->old_buckets = ht->buckets;
+  ht->old_size = ht->size;
+  ht->migrate_pos = 0;
+  ht->buckets = ht_array_alloc(sizeof(bucket_t *) * newsize, ht->huge_pages);
+  ht->size = newsize;
+  if (ht->cow) {
+    cow_resize(ht, newsize, 0);
+  }
+}
+
+/* the stop-the-world version is just an incremental one run to the end;
+   buckets are relinked in place, so nothing is allocated per entry */
+static void chained_rehash(hashtable_t *ht, unsigned long newsize) {
+  chained_rehash_incremental(ht, newsize);
+  migrate_all(ht);
+}
+
+/* Parallel rehash. Workers claim runs of REHASH_CHUNK old buckets from a
+   shared cursor, so a thread that drew long chains doesn't hold the rest
+   up, and relink each node onto the front of its new chain with a
+   compare-and-swap; two threads only meet when they prepend to the same
+   new bucket at once. As with the serial resize nothing is allocated per
+   entry and no key is rehashed. */
+#define REHASH_CHUNK 4096
+
+typedef struct {
+  hashtable_t *ht;
+  bucket_t **buckets;       /* the new array */
+  unsigned long size;
+  unsigned long next;       /* first old bucket not yet claimed */
+} par_rehash_t;
+
+static void *rehash_worker(void *arg) {
+  par_rehash_t *p = arg;
+  bucket_t *b, *next_b, *head;
+  unsigned long i, from, to, idx;
+  for (;;) {
+    from = __atomic_fetch_add(&p->next, REHASH_CHUNK, __ATOMIC_RELAXED);
+    if (from >= p->ht->size) {
+      return NULL;
     }
+    to = from + REHASH_CHUNK < p->ht->size ? from + REHASH_CHUNK : p->ht->size;
+    for (i = from; i < to; i++) {
+      for (b = p->ht->buckets[i]; b; b = next_b) {
+        next_b = b->next;
+        idx = b->hash % p->size;
+        /* the join publishes everything, so the links needn't be ordered */
+        head = __atomic_load_n(&p->buckets[idx], __ATOMIC_RELAXED);
+        do {
+          b->next = head;
+        } while (!__atomic_compare_exchange_n(&p->buckets[idx], &head, b, 1,
+                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+      }
+    }
+  }
+}
+
+void ht_rehash_parallel(hashtable_t *ht, unsigned long newsize, int nthreads) {
+  pthread_t tids[HT_MAX_REHASH_THREADS];
+  par_rehash_t p;
+  int i;
+  if (nthreads > HT_MAX_REHASH_THREADS) {
+    nthreads = HT_MAX_REHASH_THREADS;
+  }
+  /* snapshots need their chains copied, which the serial path does */
+  if (ht->backend != HT_CHAINED || ht->origin || nthreads <= 1 || snapshots_live(ht)) {
+    ht_rehash(ht, newsize);
+    return;
   }
-  /* temp pointer for the old buckets */
-  bucket_t **temp_buckets = ht->buckets;
-  /* swap the new and old buckets & sizes */
-  ht->buckets = new_ht->buckets;
-  new_ht->size = ht->size;
+  /* keys don't move in or out of the filter, so unlike ht_rehash this
+     leaves it be */
+  ht->stats.rehashes++;
+  if (ht->old_buckets) {
+    migrate_all(ht);
+  }
+  p.ht = ht;
+  p.buckets = ht_array_alloc(sizeof(bucket_t *) * newsize, ht->huge_pages);
+  p.size = newsize;
+  p.next = 0;
+  /* the calling thread is one of the workers */
+  for (i = 1; i < nthreads; i++) {
+    if (pthread_create(&tids[i], NULL, rehash_worker, &p) != 0) {
+      break;
+    }
+  }
+  rehash_worker(&p);
+  while (--i > 0) {
+    pthread_join(tids[i], NULL);
+  }
+  ht_array_free(ht->buckets);
+  ht->buckets = p.buckets;
   ht->size = newsize;
-  new_ht->buckets = temp_buckets;
-  /* now we can free the 'new' one with the old one's buckets, and the old one has new buckets */
-  free_hashtable(new_ht);
+  if (ht->cow) {
+    cow_resize(ht, newsize, 0);
+  }
+}
+
+/* Bulk builds. Keys are hashed up front, on several threads if asked,
+   then counting-sorted by bucket: one pass counts each bucket's entries,
+   a prefix sum gives every bucket its run of one slab, and a second pass
+   fills the runs. The fill writes all over the slab, so it prefetches in
+   two stages: a run's start BUILD_AHEAD keys early, and the bucket that
+   start points at half as early. Each chain is its run linked in order,
+   and the only duplicate search is within a run as it's linked. */
+#define BUILD_AHEAD 16
+
+typedef struct {
+  hashtable_t *ht;
+  char **keys;
+  size_t *lens;
+  unsigned long *hashes;
+  unsigned long *idx;       /* each key's bucket */
+  unsigned long n;
+  unsigned long next;       /* first key not yet claimed */
+} par_hash_t;
+
+static void *hash_worker(void *arg) {
+  par_hash_t *p = arg;
+  unsigned long i, from, to;
+  for (;;) {
+    from = __atomic_fetch_add(&p->next, REHASH_CHUNK, __ATOMIC_RELAXED);
+    if (from >= p->n) {
+      return NULL;
+    }
+    to = from + REHASH_CHUNK < p->n ? from + REHASH_CHUNK : p->n;
+    for (i = from; i < to; i++) {
+      p->lens[i] = strlen(p->keys[i]);
+      p->hashes[i] = p->ht->hashfn(p->keys[i], p->lens[i]);
+      p->idx[i] = p->hashes[i] % p->ht->size;
+    }
+  }
+}
+
+static int same_key(bucket_t *a, bucket_t *b) {
+  return a->hash == b->hash && bucket_keylen(a) == bucket_keylen(b)
+    && memcmp(bucket_key(a), bucket_key(b), bucket_keylen(a)) == 0;
+}
+
+hashtable_t *ht_build(const ht_opts_t *opts, char **keys, void **vals,
+                      unsigned long n, int nthreads) {
+  pthread_t tids[HT_MAX_REHASH_THREADS];
+  ht_opts_t o = *opts;
+  hashtable_t *ht;
+  par_hash_t p;
+  unsigned long *start, i, idx;
+  bucket_t *slab, *b, *q, **tail;
+  int t;
+  if (o.size < n) {
+    o.size = n;
+  }
+  o.arena = 1;
+  ht = make_hashtable_opts(&o);
+  if (ht->backend != HT_CHAINED || ht->cache || n == 0) {
+    ht_put_many(ht, keys, vals, n);
+    return ht;
+  }
+  if (nthreads > HT_MAX_REHASH_THREADS) {
+    nthreads = HT_MAX_REHASH_THREADS;
+  }
+  p.ht = ht;
+  p.keys = keys;
+  p.lens = malloc(sizeof(size_t) * n);
+  p.hashes = malloc(sizeof(unsigned long) * n);
+  p.idx = malloc(sizeof(unsigned long) * n);
+  p.n = n;
+  p.next = 0;
+  for (t = 1; t < nthreads; t++) {
+    if (pthread_create(&tids[t], NULL, hash_worker, &p) != 0) {
+      break;
+    }
+  }
+  hash_worker(&p);
+  while (--t > 0) {
+    pthread_join(tids[t], NULL);
+  }
+
+  /* start[idx + 1] counts bucket idx's entries, then the prefix sum
+     makes start[idx] where its run begins */
+  start = calloc(ht->size + 1, sizeof(unsigned long));
+  for (i = 0; i < n; i++) {
+    start[p.idx[i] + 1]++;
+  }
+  for (idx = 0; idx < ht->size; idx++) {
+    start[idx + 1] += start[idx];
+  }
+  /* filling a run moves its start up, to where the next run begins */
+  slab = arena_buckets(ht->arena, n);
+  for (i = 0; i < n; i++) {
+    if (i + BUILD_AHEAD < n) {
+      __builtin_prefetch(&start[p.idx[i + BUILD_AHEAD]], 1);
+    }
+    if (i + BUILD_AHEAD / 2 < n) {
+      __builtin_prefetch(&slab[start[p.idx[i + BUILD_AHEAD / 2]]], 1);
+    }
+    b = &slab[start[p.idx[i]]++];
+    b->hash = p.hashes[i];
+    b->val = vals[i];
+    set_key(b, keys[i], p.lens[i], 0);
+  }
+  for (idx = 0, i = 0; idx < ht->size; idx++) {
+    tail = &ht->buckets[idx];
+    for (; i < start[idx]; i++) {
+      b = &slab[i];
+      for (q = ht->buckets[idx]; q && !same_key(q, b); q = q->next)
+        ;
+      if (q) {
+        /* the later entry replaces the earlier in its place */
+        free_entry(ht, q);
+        b->next = q->next;
+        *q = *b;
+        arena_bucket_free(ht->arena, b);
+        ht->owned++;
+        ht->stats.updates++;
+        continue;
+      }
+      b->next = NULL;
+      *tail = b;
+      tail = &b->next;
+      ht->count++;
+      ht->owned++;
+      if (ht->bloom) {
+        bloom_put(ht, b->hash, 1);
+      }
+    }
+  }
+  ht->stats.puts += n;
+  free(start);
+  free(p.lens);
+  free(p.hashes);
+  free(p.idx);
+  return ht;
+}
+
+/* two rounds: every bucket slot, then every chain's first node, which
+   holds the hash and, for short keys, the key the lookup compares first */
+static void chained_prefetch(hashtable_t *ht, const unsigned long *hashes, int n) {
+  bucket_t *b;
+  int i;
+  /* mid-migration a key may be in either array; not worth guessing */
+  if (ht->old_buckets) {
+    return;
+  }
+  for (i = 0; i < n; i++) {
+    __builtin_prefetch(&ht->buckets[hashes[i] % ht->size]);
+  }
+  for (i = 0; i < n; i++) {
+    if ((b = ht->buckets[hashes[i] % ht->size])) {
+      __builtin_prefetch(b);
+    }
+  }
+}
+
+const struct ht_ops chained_ops = {
+  chained_put, chained_get, chained_del, chained_iter, chained_rehash,
+  chained_rehash_incremental, chained_destroy, NULL, chained_prefetch
+};
+
+/* snapshots share the chained lookups; the rest are no-ops */
+
+static void snapshot_put(hashtable_t *ht, char *key, size_t len, void *val,
+                         unsigned long h) {
+  free(key);
+  free(val);
+}
+
+static void snapshot_del(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+}
+
+static void snapshot_rehash(hashtable_t *ht, unsigned long newsize) {
+}
+
+/* drops snap from its table's list and frees whatever only it could
+   still see */
+static void snapshot_destroy(hashtable_t *snap) {
+  hashtable_t *ht = snap->origin, **pp, *s;
+  struct ht_cow *cow = ht->cow;
+  unsigned long oldest = ULONG_MAX, n;
+  for (pp = &cow->snaps; *pp != snap; pp = &(*pp)->next_snap)
+    ;
+  *pp = snap->next_snap;
+  free(snap->buckets);
+  free(snap);
+  /* newest first, so the last one is the oldest */
+  for (s = cow->snaps; s; s = s->next_snap) {
+    oldest = s->snap_gen;
+  }
+  /* retired in gen g means gone before any snapshot of gen g was taken */
+  for (n = 0; n < cow->nretired && cow->retired[n].gen <= oldest; n++) {
+    free_retired(ht, &cow->retired[n]);
+  }
+  memmove(cow->retired, cow->retired + n, sizeof(retired_t) * (cow->nretired - n));
+  cow->nretired -= n;
+}
+
+static const struct ht_ops snapshot_ops = {
+  snapshot_put, chained_get, snapshot_del, chained_iter, snapshot_rehash,
+  snapshot_rehash, snapshot_destroy, NULL, chained_prefetch
+};
+
+hashtable_t *ht_snapshot(hashtable_t *ht) {
+  hashtable_t *snap;
+  /* a cache's gets move entries about, which a snapshot can't share */
+  if (ht->backend != HT_CHAINED || ht->origin || ht->cache) {
+    return NULL;
+  }
+  /* one bucket array to copy, not two */
+  if (ht->old_buckets) {
+    migrate_all(ht);
+  }
+  if (!ht->cow) {
+    ht->cow = calloc(1, sizeof(struct ht_cow));
+    ht->cow->gen = 1;
+    ht->cow->chain_gen = calloc(sizeof(unsigned long), ht->size);
+  }
+  snap = calloc(1, sizeof(hashtable_t));
+  snap->backend = HT_CHAINED;
+  snap->ops = &snapshot_ops;
+  snap->hashfn = ht->hashfn;
+  snap->size = ht->size;
+  snap->min_size = ht->size;
+  snap->buckets = malloc(sizeof(bucket_t *) * ht->size);
+  memcpy(snap->buckets, ht->buckets, sizeof(bucket_t *) * ht->size);
+  snap->count = ht->count;
+  snap->origin = ht;
+  /* writes from here on happen in the next gen */
+  snap->snap_gen = ht->cow->gen++;
+  snap->next_snap = ht->cow->snaps;
+  ht->cow->snaps = snap;
+  return snap;
+}
+
+void ht_release_snapshot(hashtable_t *snap) {
+  free_hashtable(snap);
 }
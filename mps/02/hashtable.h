@@ -1,28 +1,262 @@
 #ifndef HASHTABLE_T
 #define HASHTABLE_T
 
+#include <stddef.h>
+#include <stdint.h>
+
 typedef struct hashtable hashtable_t;
 typedef struct bucket bucket_t;
+typedef struct ht_slot ht_slot_t;
+
+/* storage engines, picked when the table is made */
+typedef enum {
+  HT_CHAINED = 0,   /* array of singly linked bucket chains */
+  HT_ROBINHOOD,     /* open addressing with Robin Hood probing */
+  HT_SWISS,         /* open addressing, 16-wide control-byte groups */
+  HT_COMPACT,       /* entries in a dense insertion-ordered array, indexed */
+  HT_MAPPED         /* read-only ht_save image; only ht_open_mapped makes these */
+} ht_backend_t;
+
+/* hashes len bytes of key; set per table in ht_opts_t */
+typedef unsigned long (*ht_hash_fn)(const void *key, size_t len);
+
+/* which entry a full cache table gives up; see ht_opts_t.capacity */
+typedef enum {
+  HT_EVICT_LRU = 0,   /* least recently put or got; every hit relinks it */
+  HT_EVICT_CLOCK      /* a hit only sets a bit; a hand sweeping the entries
+                         clears bits and takes the first entry without one */
+} ht_evict_t;
+
+/* handed each evicted entry; key is only good for the call, val is the
+   callback's to free */
+typedef void (*ht_evict_fn)(void *ctx, char *key, size_t keylen, void *val);
+
+/* construction options for make_hashtable_opts; zeroed fields give the
+   same table make_hashtable_backend(size, backend) would */
+typedef struct ht_opts {
+  ht_backend_t backend;
+  unsigned long size;     /* initial size; the table never shrinks below it */
+  double max_load;        /* double the size when count/size exceeds this; 0 = never */
+  double min_load;        /* halve it when count/size drops below this; 0 = never.
+                             capped at max_load / 4 so a shrink can't trigger a grow */
+  int incremental;        /* resize with ht_rehash_incremental (chained only) */
+  int arena;              /* take buckets from slabs and back ht_put_copy with a
+                             bump arena (chained only) */
+  ht_hash_fn hash;        /* NULL = ht_hash_djb2, the same values as hash() */
+  /* cache mode (chained only, and not with arena): once a put leaves more
+     than capacity entries, one is evicted as evict says; 0 = unbounded */
+  unsigned long capacity;
+  ht_evict_t evict;
+  ht_evict_fn on_evict;   /* NULL just frees the value */
+  void *evict_ctx;
+  int bloom;              /* keep a Bloom filter of the keys, so most gets of
+                             absent keys never touch the table */
+  /* back the bucket or slot arrays, and an arena's slabs, with huge pages
+     where the system has them, so random lookups in a big table miss the
+     TLB less; a table of under a huge page, or a system without them,
+     gets ordinary memory */
+  int huge_pages;
+} ht_opts_t;
+
+/* keys up to this long are stored in the bucket itself, so a lookup
+   compares them without following a pointer; 22 keeps bucket_t at 48
+   bytes */
+#define HT_INLINE_KEY 22
 
 struct bucket {
-  char *key;
+  unsigned long hash;     /* full hash of key, so rehashing never recomputes it */
   void *val;
   bucket_t *next;
+  union {
+    struct {              /* longer keys */
+      char *key_ptr;
+      size_t key_len;
+    };
+    struct {
+      /* B_INLINE: the key, then a NUL, with HT_INLINE_KEY less the key's
+         length in the last byte; a full-length key's NUL is that byte */
+      char key_buf[HT_INLINE_KEY + 1];
+      unsigned char flags;  /* B_ARENA: key and val live in the table's arena */
+    };
+  };
 };
 
+/* one slot of an open-addressed array; key == NULL marks it unused */
+struct ht_slot {
+  unsigned long hash;
+  char *key;
+  void *val;
+  size_t keylen;
+};
+
+/* lookups whose probe length is this or more share the last histogram bin */
+#define HT_PROBE_HIST 16
+
+/* operation counters every table keeps as it goes; see ht_stats. A
+   lookup's probe length is how many chain nodes (chained), slots
+   (robinhood), groups (swiss), index cells (compact) or image entries
+   (mapped) it looked at. */
+typedef struct ht_stats {
+  unsigned long gets, hits, misses;
+  unsigned long puts, updates;    /* updates: puts to a key already there */
+  unsigned long deletes;          /* calls, whether or not the key was there */
+  unsigned long rehashes;         /* requested and automatic resizes both */
+  unsigned long evictions;        /* entries a cache table gave up for room */
+  /* misses the Bloom filter answered, and ones it let through to the
+     table: its false positives */
+  unsigned long bloom_rejects, bloom_false_pos;
+  unsigned long probes;           /* probe lengths summed over every lookup */
+  unsigned long probe_hist[HT_PROBE_HIST];  /* lookups by probe length */
+} ht_stats_t;
+
+/* one entry of an ht_save image; key and val are byte offsets from the
+   start of the image to NUL-terminated strings, though the key may hold
+   NULs of its own */
+typedef struct ht_image_entry {
+  uint64_t hash;
+  uint64_t key;
+  uint64_t val;
+  uint64_t keylen;
+} ht_image_entry_t;
+
 struct hashtable {
-  unsigned long size;
-  bucket_t **buckets;
+  ht_backend_t backend;
+  const struct ht_ops *ops;
+  ht_hash_fn hashfn;
+  unsigned long size;     /* buckets (chained) or slots (open addressing) */
+  bucket_t **buckets;     /* HT_CHAINED */
+  ht_slot_t *slots;       /* HT_ROBINHOOD, HT_SWISS; HT_COMPACT's entries */
+  unsigned char *ctrl;    /* HT_SWISS: one control byte per slot */
+  unsigned long growth_left;  /* HT_SWISS: EMPTY slots we may still fill */
+  /* HT_COMPACT: size cells, each an offset into slots or 0xFFFFFFFF; the
+     first nentries slots are in use, deleted ones with a NULL key */
+  uint32_t *index;
+  unsigned long nentries;
+  unsigned long count;    /* live entries */
+  /* automatic resizing; see ht_opts_t */
+  unsigned long min_size;
+  double max_load;
+  double min_load;
+  int incremental;
+  /* incremental rehash in progress (chained only); see ht_rehash_incremental */
+  bucket_t **old_buckets;
+  unsigned long old_size;
+  unsigned long migrate_pos;  /* old buckets below this have been moved */
+  /* slab/bump allocator (chained only), and how many entries it doesn't own */
+  struct ht_arena *arena;
+  unsigned long owned;
+  /* cache mode (chained only): recency ring and eviction policy */
+  struct ht_cache *cache;
+  struct ht_bloom *bloom;     /* see ht_opts_t.bloom */
+  int huge_pages;             /* see ht_opts_t.huge_pages */
+  /* HT_MAPPED: the image's entries for bucket i are
+     image_entries[image_start[i]] up to image_entries[image_start[i+1]];
+     writes go to overlay, where a NULL value hides a key in the image */
+  const char *image;
+  size_t image_len;
+  const uint64_t *image_start;
+  const ht_image_entry_t *image_entries;
+  hashtable_t *overlay;
+  ht_stats_t stats;
+  /* copy-on-write snapshots (chained only); see ht_snapshot */
+  struct ht_cow *cow;         /* the live table's, once one has been taken */
+  hashtable_t *origin;        /* a snapshot's live table */
+  hashtable_t *next_snap;     /* the next older snapshot of origin */
+  unsigned long snap_gen;     /* origin's generation when this was taken */
 };
 
 unsigned long hash(char *str);
+/* built-in hash functions for ht_opts_t.hash */
+unsigned long ht_hash_djb2(const void *key, size_t len);
+unsigned long ht_hash_wy(const void *key, size_t len);   /* 8 bytes at a time */
+/* a fixed number for each built-in function, for files that record which
+   made their hashes (ht_save images, compiled traces); -1 or NULL for
+   any other */
+int ht_hash_id(ht_hash_fn f);
+ht_hash_fn ht_hash_by_id(uint64_t id);
 
 hashtable_t *make_hashtable(unsigned long size);
+hashtable_t *make_hashtable_backend(unsigned long size, ht_backend_t backend);
+hashtable_t *make_hashtable_opts(const ht_opts_t *opts);
 void  ht_put(hashtable_t *ht, char *key, void *val);
+/* copies key and vallen bytes of val into the table instead of taking
+   ownership; arena tables keep the copies in their arena */
+void  ht_put_copy(hashtable_t *ht, const char *key, const void *val, size_t vallen);
 void *ht_get(hashtable_t *ht, char *key);
 void  ht_del(hashtable_t *ht, char *key);
+/* the same for binary keys of keylen bytes, NULs and all; the string
+   calls are these with keylen = strlen(key). ht_put_n takes ownership of
+   key as ht_put does. */
+void  ht_put_n(hashtable_t *ht, char *key, size_t keylen, void *val);
+void *ht_get_n(hashtable_t *ht, const char *key, size_t keylen);
+void  ht_del_n(hashtable_t *ht, const char *key, size_t keylen);
+/* and again for callers that already have the key's hash under the
+   table's own function, ht->hashfn, as a compiled trace does; a hash made
+   any other way leaves the key unfindable */
+void  ht_put_hashed(hashtable_t *ht, char *key, size_t keylen, void *val, unsigned long h);
+void *ht_get_hashed(hashtable_t *ht, const char *key, size_t keylen, unsigned long h);
+void  ht_del_hashed(hashtable_t *ht, const char *key, size_t keylen, unsigned long h);
+/* ht_get/ht_put over n keys at once. Keys are hashed a batch at a time
+   and the memory each lookup starts at is prefetched before any of the
+   batch is resolved, so the cache misses overlap instead of queueing.
+   vals[i] is set to key i's value, or NULL. */
+void  ht_get_many(hashtable_t *ht, char **keys, unsigned long n, void **vals);
+void  ht_put_many(hashtable_t *ht, char **keys, void **vals, unsigned long n);
 void  ht_iter(hashtable_t *ht, int (*f)(char *, void *));
+/* ht_iter with each key's length; a binary key needn't end in a NUL */
+void  ht_iter_n(hashtable_t *ht, int (*f)(char *, size_t, void *));
 void  ht_rehash(hashtable_t *ht, unsigned long newsize);
+/* starts a resize that migrates a few chains on each later put/get/del */
+void  ht_rehash_incremental(hashtable_t *ht, unsigned long newsize);
+/* ht_rehash spread over nthreads threads, the caller among them; for
+   chained tables large enough that a resize takes seconds. Other backends,
+   and tables with live snapshots, resize on the calling thread alone. */
+#define HT_MAX_REHASH_THREADS 256
+void  ht_rehash_parallel(hashtable_t *ht, unsigned long newsize, int nthreads);
+/* makes a table holding n entries at once, as make_hashtable_opts and an
+   ht_put of each pair in turn would, so of two equal keys the later one
+   wins; takes ownership of keys and vals. The table is sized for at least
+   n. A chained one has its keys hashed on nthreads threads (the caller
+   among them, up to HT_MAX_REHASH_THREADS) and its buckets laid out in one
+   slab, each chain's side by side, so it always uses an arena as
+   opts.arena would. Other backends and cache tables get ht_put_many. */
+hashtable_t *ht_build(const ht_opts_t *opts, char **keys, void **vals,
+                      unsigned long n, int nthreads);
 void  free_hashtable(hashtable_t *ht);
 
+/* for open-addressed backends, how far the entry in slot idx sits from
+   where its probe started: slots for robinhood, groups for swiss, index
+   cells for compact */
+unsigned long ht_probe_len(hashtable_t *ht, unsigned long idx);
+
+/* copies out the table's counters; constant time, nothing is scanned */
+void  ht_stats(hashtable_t *ht, ht_stats_t *out);
+
+/* A read-only view of a chained table as it stands, for long scans that
+   shouldn't hold writers up. Taking one copies the bucket array, not the
+   entries. From then on the table copies a chain before changing anything
+   in it a snapshot can see, and what it replaces is freed only once every
+   snapshot that could see it has been released. ht_get, ht_iter and
+   friends work on a snapshot as on a table; puts, deletes and rehashes on
+   one are ignored, and a put's key and value are freed. NULL for other
+   backends.
+   Like every other call, ht_snapshot and ht_release_snapshot must be
+   serialized with writes to the table. Reading a snapshot needn't be, so
+   one thread can scan it while others keep writing. Release every
+   snapshot before freeing the table. */
+hashtable_t *ht_snapshot(hashtable_t *ht);
+void  ht_release_snapshot(hashtable_t *snap);
+
+/* writes every entry to path as an image ht_open_mapped can use in place.
+   Values are saved as NUL-terminated strings. Returns 0, or -1 if the
+   file can't be written or the table uses a hash other than the built-in
+   ones. */
+int ht_save(hashtable_t *ht, const char *path);
+/* maps an image written by ht_save. Opening checks the header, bucket
+   index and entries once, but nothing is copied, and the strings' pages
+   are read in as lookups touch them. Keys and values handed back point
+   into the read-only mapping. Puts and deletes go to a heap overlay and
+   never change the file. Returns NULL if path isn't a valid image. */
+hashtable_t *ht_open_mapped(const char *path);
+
 #endif
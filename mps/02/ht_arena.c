@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable.h"
+#include "ht_internal.h"
+
+/* Per-table allocator for arena-mode chained tables. Buckets are carved
+   out of fixed-size slabs and recycled through a free list on delete, so
+   neighbouring inserts land on neighbouring cache lines. Copied keys and
+   values are bumped out of larger blocks and only given back when the
+   table goes away. Teardown frees whole slabs and blocks, never entries.
+   A huge arena's slabs are a huge page each, from ht_array_alloc. */
+
+#define SLAB_BUCKETS 1024
+#define BLOCK_BYTES  (64 * 1024)
+#define ARENA_ALIGN  16
+#define ARENA_ROUND(n) (((n) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+
+typedef struct arena_block arena_block_t;
+struct arena_block {
+  arena_block_t *next;
+  /* payload follows, aligned to ARENA_ALIGN */
+};
+#define BLOCK_HDR ARENA_ROUND(sizeof(arena_block_t))
+
+struct ht_arena {
+  int huge;
+  unsigned long slab_buckets;
+  arena_block_t *slabs;
+  bucket_t *free_buckets;     /* linked through next */
+  bucket_t *slab_next;        /* unused tail of the newest slab */
+  unsigned long slab_left;
+  arena_block_t *blocks;
+  char *bump;                 /* unused tail of the newest block */
+  size_t bump_left;
+};
+
+static void *new_block(arena_block_t **list, size_t bytes) {
+  arena_block_t *blk = malloc(BLOCK_HDR + bytes);
+  blk->next = *list;
+  *list = blk;
+  return (char *)blk + BLOCK_HDR;
+}
+
+static void *new_slab(struct ht_arena *a, size_t bytes) {
+  arena_block_t *blk;
+  if (!a->huge) {
+    return new_block(&a->slabs, bytes);
+  }
+  blk = ht_array_alloc(BLOCK_HDR + bytes, 1);
+  blk->next = a->slabs;
+  a->slabs = blk;
+  return (char *)blk + BLOCK_HDR;
+}
+
+struct ht_arena *arena_create(int huge) {
+  struct ht_arena *a = calloc(1, sizeof(struct ht_arena));
+  a->huge = huge;
+  /* whatever of the page ht_array_alloc leaves */
+  a->slab_buckets = huge ? (HT_HUGE_PAGE - HT_ARRAY_HDR - BLOCK_HDR) / sizeof(bucket_t)
+                         : SLAB_BUCKETS;
+  return a;
+}
+
+bucket_t *arena_bucket(struct ht_arena *a) {
+  bucket_t *b = a->free_buckets;
+  if (b) {
+    a->free_buckets = b->next;
+    return b;
+  }
+  if (a->slab_left == 0) {
+    a->slab_next = new_slab(a, a->slab_buckets * sizeof(bucket_t));
+    a->slab_left = a->slab_buckets;
+  }
+  a->slab_left--;
+  return a->slab_next++;
+}
+
+/* n buckets side by side, in a slab of their own */
+bucket_t *arena_buckets(struct ht_arena *a, unsigned long n) {
+  return new_slab(a, n * sizeof(bucket_t));
+}
+
+void arena_bucket_free(struct ht_arena *a, bucket_t *b) {
+  b->next = a->free_buckets;
+  a->free_buckets = b;
+}
+
+void *arena_copy(struct ht_arena *a, const void *src, size_t len) {
+  size_t need = ARENA_ROUND(len);
+  char *dst;
+  if (need > BLOCK_BYTES / 4) {
+    /* big copies get a block of their own so they don't waste the tail */
+    dst = new_block(&a->blocks, need);
+  } else {
+    if (need > a->bump_left) {
+      a->bump = new_block(&a->blocks, BLOCK_BYTES);
+      a->bump_left = BLOCK_BYTES;
+    }
+    dst = a->bump;
+    a->bump += need;
+    a->bump_left -= need;
+  }
+  memcpy(dst, src, len);
+  return dst;
+}
+
+static void free_blocks(arena_block_t *blk, int huge) {
+  arena_block_t *next;
+  while (blk) {
+    next = blk->next;
+    if (huge) {
+      ht_array_free(blk);
+    } else {
+      free(blk);
+    }
+    blk = next;
+  }
+}
+
+void arena_destroy(struct ht_arena *a) {
+  free_blocks(a->slabs, a->huge);
+  free_blocks(a->blocks, 0);
+  free(a);
+}
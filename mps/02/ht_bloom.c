@@ -0,0 +1,47 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable.h"
+#include "ht_internal.h"
+
+/* Blocked Bloom filter over a table's key hashes. Each key sets
+   BLOOM_K bits, all in one 64-byte block, so a lookup costs a single
+   cache line however many bits it tests. Packing the bits into a block
+   costs some accuracy next to a plain filter; at BLOOM_BITS_PER_KEY it
+   still turns away nearly 99% of absent keys. The filter can't forget a
+   key, so the table rebuilds it as keys come and go; see bloom_put in
+   hashtable.c. */
+
+#define BLOOM_BITS_PER_KEY 10
+#define BLOCK_BITS (BLOOM_WORDS * 64)
+
+struct ht_bloom *bloom_create(unsigned long keys) {
+  struct ht_bloom *f = malloc(sizeof(struct ht_bloom));
+  unsigned long blocks = 1;
+  /* a power of two, so picking the block is a mask */
+  while (blocks * BLOCK_BITS < keys * BLOOM_BITS_PER_KEY) {
+    blocks <<= 1;
+  }
+  f->blocks = aligned_alloc(64, blocks * BLOOM_WORDS * sizeof(uint64_t));
+  memset(f->blocks, 0, blocks * BLOOM_WORDS * sizeof(uint64_t));
+  f->mask = blocks - 1;
+  f->capacity = keys;
+  f->added = 0;
+  f->removed = 0;
+  return f;
+}
+
+void bloom_add(struct ht_bloom *f, unsigned long h) {
+  uint64_t *blk = bloom_block(f, h);
+  unsigned long x = bloom_bits(h);
+  int i;
+  for (i = 0; i < BLOOM_K; i++, x >>= 9) {
+    blk[(x >> 6) & (BLOOM_WORDS - 1)] |= 1UL << (x & 63);
+  }
+}
+
+void bloom_destroy(struct ht_bloom *f) {
+  if (f) {
+    free(f->blocks);
+    free(f);
+  }
+}
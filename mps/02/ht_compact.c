@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable.h"
+#include "ht_internal.h"
+
+/* Compact layout, after CPython's dict: entries live densely in slots[],
+   in the order they were first inserted, and the hash index is just an
+   array of 32-bit offsets into it, probed linearly. Iteration is a scan
+   of slots[0..nentries) that never looks at the index, so it costs the
+   number of entries rather than the table size. A delete empties its
+   entry where it stands and backward-shifts the index run; the holes are
+   squeezed out once they make up half the array, or when an insert finds
+   the array full and a quarter of it is holes. */
+
+#define IX_EMPTY 0xFFFFFFFFu
+#define CP_MIN_CELLS 8
+
+/* entries the array holds per index size; the index stays under 3/4 full */
+#define CP_USABLE(cells) ((cells) - (cells) / 4)
+
+#define CP_MASK(ht) ((ht)->size - 1)
+#define CP_HOME(ht, h) ((h) & CP_MASK(ht))
+
+static unsigned long cp_capacity(unsigned long want) {
+  unsigned long cap = CP_MIN_CELLS;
+  while (cap < want)
+    cap <<= 1;
+  return cap;
+}
+
+/* which index cell points at entry e; e must be live */
+static unsigned long cp_cell(hashtable_t *ht, unsigned long e) {
+  unsigned long idx = CP_HOME(ht, ht->slots[e].hash);
+  while (ht->index[idx] != e)
+    idx = (idx + 1) & CP_MASK(ht);
+  return idx;
+}
+
+/* index cells between entry idx's home and where it's filed */
+static unsigned long cp_probe_len(hashtable_t *ht, unsigned long idx) {
+  return (cp_cell(ht, idx) - CP_HOME(ht, ht->slots[idx].hash)) & CP_MASK(ht);
+}
+
+static void cp_index_insert(hashtable_t *ht, unsigned long h, uint32_t e) {
+  unsigned long idx = CP_HOME(ht, h);
+  while (ht->index[idx] != IX_EMPTY)
+    idx = (idx + 1) & CP_MASK(ht);
+  ht->index[idx] = e;
+}
+
+/* squeezes the holes out of slots[], keeping entries in order; each
+   moved entry's index cell is repointed, so this costs the entries, not
+   the index */
+static void cp_compact(hashtable_t *ht) {
+  unsigned long i, n = 0;
+  for (i = 0; i < ht->nentries; i++) {
+    if (!ht->slots[i].key)
+      continue;
+    if (i != n) {
+      ht->index[cp_cell(ht, i)] = n;
+      ht->slots[n] = ht->slots[i];
+    }
+    n++;
+  }
+  ht->nentries = n;
+}
+
+static void cp_resize(hashtable_t *ht, unsigned long cells) {
+  unsigned long i;
+  ht->stats.rehashes++;
+  cp_compact(ht);
+  ht_array_free(ht->index);
+  ht->index = ht_array_alloc(sizeof(uint32_t) * cells, ht->huge_pages);
+  /* every byte 0xFF makes every cell IX_EMPTY */
+  memset(ht->index, 0xFF, sizeof(uint32_t) * cells);
+  ht->slots = ht_array_realloc(ht->slots, sizeof(ht_slot_t) * CP_USABLE(ht->size),
+                               sizeof(ht_slot_t) * CP_USABLE(cells), ht->huge_pages);
+  ht->size = cells;
+  for (i = 0; i < ht->nentries; i++)
+    cp_index_insert(ht, ht->slots[i].hash, i);
+}
+
+void cp_init(hashtable_t *ht, unsigned long size) {
+  ht->size = cp_capacity(size);
+  ht->index = ht_array_alloc(sizeof(uint32_t) * ht->size, ht->huge_pages);
+  memset(ht->index, 0xFF, sizeof(uint32_t) * ht->size);
+  ht->slots = ht_array_alloc(sizeof(ht_slot_t) * CP_USABLE(ht->size), ht->huge_pages);
+  ht->nentries = 0;
+  ht->count = 0;
+}
+
+/* the entry holding key, or -1; its index cell goes in *cell */
+static long cp_find(hashtable_t *ht, unsigned long h, const char *key, size_t len,
+                    unsigned long *cell) {
+  unsigned long idx = CP_HOME(ht, h), steps = 1;
+  ht_slot_t *s;
+  uint32_t e;
+  while ((e = ht->index[idx]) != IX_EMPTY) {
+    s = &ht->slots[e];
+    if (s->hash == h && s->keylen == len && memcmp(s->key, key, len) == 0) {
+      ht_note_probe(ht, steps);
+      *cell = idx;
+      return e;
+    }
+    idx = (idx + 1) & CP_MASK(ht);
+    steps++;
+  }
+  ht_note_probe(ht, steps);
+  return -1;
+}
+
+static void cp_put(hashtable_t *ht, char *key, size_t len, void *val, unsigned long h) {
+  unsigned long cell;
+  long e = cp_find(ht, h, key, len, &cell);
+  if (e >= 0) {
+    /* update entry; it keeps its place in the order */
+    free(ht->slots[e].key);
+    free(ht->slots[e].val);
+    ht->slots[e].key = key;
+    ht->slots[e].val = val;
+    return;
+  }
+  if (ht->nentries == CP_USABLE(ht->size)) {
+    /* a quarter of the array in holes is worth reclaiming as it stands */
+    if (ht->nentries - ht->count >= CP_USABLE(ht->size) / 4)
+      cp_compact(ht);
+    else
+      cp_resize(ht, ht->size << 1);
+  }
+  ht->slots[ht->nentries].hash = h;
+  ht->slots[ht->nentries].key = key;
+  ht->slots[ht->nentries].val = val;
+  ht->slots[ht->nentries].keylen = len;
+  cp_index_insert(ht, h, ht->nentries);
+  ht->nentries++;
+  ht->count++;
+}
+
+static void *cp_get(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+  unsigned long cell;
+  long e = cp_find(ht, h, key, len, &cell);
+  return e >= 0 ? ht->slots[e].val : NULL;
+}
+
+static void cp_del(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+  unsigned long cell, next, home;
+  long e = cp_find(ht, h, key, len, &cell);
+  if (e < 0)
+    return;
+  free(ht->slots[e].key);
+  free(ht->slots[e].val);
+  ht->slots[e].key = NULL;
+  ht->slots[e].val = NULL;
+  /* backward shift: a later cell in the run moves up if the gap is no
+     further from it than its own home is */
+  next = cell;
+  for (;;) {
+    next = (next + 1) & CP_MASK(ht);
+    if (ht->index[next] == IX_EMPTY)
+      break;
+    home = CP_HOME(ht, ht->slots[ht->index[next]].hash);
+    if (((next - home) & CP_MASK(ht)) >= ((next - cell) & CP_MASK(ht))) {
+      ht->index[cell] = ht->index[next];
+      cell = next;
+    }
+  }
+  ht->index[cell] = IX_EMPTY;
+  ht->count--;
+  /* holes at the end cost nothing to drop */
+  while (ht->nentries > 0 && !ht->slots[ht->nentries - 1].key)
+    ht->nentries--;
+  if (ht->nentries - ht->count > ht->nentries / 2)
+    cp_compact(ht);
+}
+
+static void cp_iter(hashtable_t *ht, ht_visit_fn visit, void *ctx) {
+  unsigned long i;
+  ht_slot_t *s;
+  for (i = 0; i < ht->nentries; i++) {
+    s = &ht->slots[i];
+    if (s->key && !visit(ctx, s->key, s->keylen, s->val))
+      return; // abort iteration
+  }
+}
+
+static void cp_rehash(hashtable_t *ht, unsigned long newsize) {
+  unsigned long cap = cp_capacity(newsize);
+  /* never shrink below what the current entries need */
+  while (CP_USABLE(cap) < ht->count)
+    cap <<= 1;
+  cp_resize(ht, cap);
+}
+
+static void cp_destroy(hashtable_t *ht) {
+  unsigned long i;
+  for (i = 0; i < ht->nentries; i++) {
+    if (ht->slots[i].key) {
+      free(ht->slots[i].key);
+      free(ht->slots[i].val);
+    }
+  }
+  ht_array_free(ht->slots);
+  ht_array_free(ht->index);
+  free(ht);
+}
+
+/* the home cell; the entry it names is a second, unpredictable fetch */
+static void cp_prefetch(hashtable_t *ht, const unsigned long *hashes, int n) {
+  int i;
+  for (i = 0; i < n; i++)
+    __builtin_prefetch(&ht->index[CP_HOME(ht, hashes[i])]);
+}
+
+const struct ht_ops compact_ops = {
+  /* the index is rebuilt whole, so resizes are never incremental */
+  cp_put, cp_get, cp_del, cp_iter, cp_rehash, cp_rehash, cp_destroy,
+  cp_probe_len, cp_prefetch
+};
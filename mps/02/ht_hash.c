@@ -0,0 +1,82 @@
+#include <stdint.h>
+#include <string.h>
+#include "hashtable.h"
+
+/* Hash functions a table can be built with (ht_opts_t.hash). */
+
+/* files can only name hash functions both sides know about */
+int ht_hash_id(ht_hash_fn f) {
+  if (f == ht_hash_djb2)
+    return 0;
+  if (f == ht_hash_wy)
+    return 1;
+  return -1;
+}
+
+ht_hash_fn ht_hash_by_id(uint64_t id) {
+  return id == 0 ? ht_hash_djb2 : id == 1 ? ht_hash_wy : NULL;
+}
+
+/* the same "times 33" function as hash(), over an explicit length */
+unsigned long ht_hash_djb2(const void *key, size_t len) {
+  const unsigned char *p = key;
+  unsigned long hash = 5381;
+  while (len--)
+    hash = ((hash << 5) + hash) + *p++; /* hash * 33 + c */
+  return hash;
+}
+
+/* After Wang Yi's wyhash: reads the key 8 bytes at a time and folds each
+   pair of words with a 64x64->128 bit multiply, xoring the two halves of
+   the product together. Every output bit depends on every input bit, so
+   both the low bits (robinhood's mask) and high bits (swiss's h1) are
+   usable. */
+
+#define WY_P0 0xa0761d6478bd642full
+#define WY_P1 0xe7037ed1a0b428dbull
+#define WY_P2 0x8ebc6af09c88c6e3ull
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wy_r8(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline uint64_t wy_r4(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+unsigned long ht_hash_wy(const void *key, size_t len) {
+  const unsigned char *p = key;
+  uint64_t seed = WY_P0, a, b;
+  size_t i = len;
+  if (len <= 16) {
+    if (len >= 4) {
+      /* two overlapping 4-byte reads from each end cover 4..16 bytes */
+      a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+      b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    while (i > 16) {
+      seed = wy_mix(wy_r8(p) ^ WY_P1, wy_r8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    /* the last 16 bytes, overlapping what's been mixed if need be */
+    a = wy_r8(p + i - 16);
+    b = wy_r8(p + i - 8);
+  }
+  return wy_mix(WY_P1 ^ len, wy_mix(a ^ WY_P1, b ^ seed ^ WY_P2));
+}
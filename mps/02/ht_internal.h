@@ -0,0 +1,127 @@
+#ifndef HT_INTERNAL_H
+#define HT_INTERNAL_H
+
+#include <string.h>
+#include "hashtable.h"
+
+/* ht_iter and ht_iter_n both visit entries through one of these; ctx
+   is the caller's own callback */
+typedef int (*ht_visit_fn)(void *ctx, char *key, size_t keylen, void *val);
+
+/* per-backend operations; the public ht_* calls dispatch through these.
+   put, get and del are handed the key's length and hash, so the public
+   layer hashes each key once and batches can hash a whole run of keys up
+   front. Keys match when hash and length do and memcmp agrees. */
+struct ht_ops {
+  void  (*put)(hashtable_t *ht, char *key, size_t len, void *val, unsigned long h);
+  void *(*get)(hashtable_t *ht, const char *key, size_t len, unsigned long h);
+  void  (*del)(hashtable_t *ht, const char *key, size_t len, unsigned long h);
+  void  (*iter)(hashtable_t *ht, ht_visit_fn visit, void *ctx);
+  void  (*rehash)(hashtable_t *ht, unsigned long newsize);
+  void  (*rehash_incremental)(hashtable_t *ht, unsigned long newsize);
+  void  (*destroy)(hashtable_t *ht);
+  unsigned long (*probe_len)(hashtable_t *ht, unsigned long idx);  /* NULL if chained */
+  /* starts loading whatever a lookup of each hash will touch first; NULL
+     if there's nothing worth fetching early */
+  void  (*prefetch)(hashtable_t *ht, const unsigned long *hashes, int n);
+};
+
+extern const struct ht_ops chained_ops;
+extern const struct ht_ops robinhood_ops;
+extern const struct ht_ops swiss_ops;
+extern const struct ht_ops compact_ops;
+extern const struct ht_ops mapped_ops;
+
+/* records one lookup that looked at n nodes, slots, groups or cells */
+static inline void ht_note_probe(hashtable_t *ht, unsigned long n) {
+  ht->stats.probes += n;
+  ht->stats.probe_hist[n < HT_PROBE_HIST ? n : HT_PROBE_HIST - 1]++;
+}
+
+/* the chained bucket holding key (whose hash is h), or NULL; the mapped
+   overlay needs to tell a NULL value apart from a missing key */
+bucket_t *chained_find(hashtable_t *ht, const char *key, size_t len, unsigned long h);
+
+void rh_init(hashtable_t *ht, unsigned long size);
+void sw_init(hashtable_t *ht, unsigned long size);
+void cp_init(hashtable_t *ht, unsigned long size);
+
+/* bucket_t flags */
+#define B_ARENA  0x1
+#define B_INLINE 0x2    /* the key is in key_buf rather than at key_ptr */
+#define B_REF    0x4    /* HT_EVICT_CLOCK: used since the hand last passed */
+
+static inline char *bucket_key(bucket_t *b) {
+  return (b->flags & B_INLINE) ? b->key_buf : b->key_ptr;
+}
+
+static inline size_t bucket_keylen(bucket_t *b) {
+  return (b->flags & B_INLINE)
+    ? HT_INLINE_KEY - (unsigned char)b->key_buf[HT_INLINE_KEY] : b->key_len;
+}
+
+/* ht_bloom.c: blocked Bloom filter of key hashes; see ht_opts_t.bloom.
+   The test is inline, as every get of a filtered table makes it. */
+#define BLOOM_WORDS 8   /* 64-bit words per block: one cache line */
+#define BLOOM_K     6   /* bits per key; 9 bits each of bloom_bits picks one */
+
+struct ht_bloom {
+  uint64_t *blocks;
+  unsigned long mask;       /* blocks - 1 */
+  unsigned long capacity;   /* keys it was sized for */
+  unsigned long added;      /* keys put in since it was built, live or not */
+  unsigned long removed;    /* of those and the ones it was built with,
+                               how many have been deleted or evicted */
+};
+
+struct ht_bloom *bloom_create(unsigned long keys);
+void  bloom_add(struct ht_bloom *f, unsigned long h);
+void  bloom_destroy(struct ht_bloom *f);
+
+/* the block and the bits come from different multiplies of the hash,
+   since djb2 leaves the high bits of a short key's hash empty and both
+   need bits the table's own index doesn't use */
+static inline uint64_t *bloom_block(const struct ht_bloom *f, unsigned long h) {
+  return f->blocks + (((h * 0x9E3779B97F4A7C15UL) >> 32) & f->mask) * BLOOM_WORDS;
+}
+
+static inline unsigned long bloom_bits(unsigned long h) {
+  return ((h ^ (h >> 31)) * 0xBF58476D1CE4E5B9UL) >> 10;
+}
+
+/* 0 if no key with hash h was ever added */
+static inline int bloom_maybe(const struct ht_bloom *f, unsigned long h) {
+  const uint64_t *blk = bloom_block(f, h);
+  unsigned long x = bloom_bits(h);
+  int i;
+  for (i = 0; i < BLOOM_K; i++, x >>= 9) {
+    if (!(blk[(x >> 6) & (BLOOM_WORDS - 1)] & (1UL << (x & 63)))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* ht_pages.c: the tables' big arrays, zeroed like calloc. With huge set,
+   one that fills a huge page or more is mapped on huge pages when the
+   system will give them out, and comes from the heap otherwise. */
+#define HT_HUGE_PAGE (2UL << 20)
+#define HT_ARRAY_HDR 64     /* bookkeeping in front of each array */
+
+enum { HT_PAGES_SMALL, HT_PAGES_THP, HT_PAGES_HUGETLB };
+
+void *ht_array_alloc(size_t bytes, int huge);
+void *ht_array_realloc(void *p, size_t old_bytes, size_t bytes, int huge);
+void  ht_array_free(void *p);
+int   ht_array_pages(const void *p);   /* HT_PAGES_* */
+
+/* ht_arena.c: bucket slabs plus a bump allocator for copied keys/values;
+   a huge arena's slabs are a huge page each */
+struct ht_arena *arena_create(int huge);
+bucket_t *arena_bucket(struct ht_arena *a);
+bucket_t *arena_buckets(struct ht_arena *a, unsigned long n);
+void  arena_bucket_free(struct ht_arena *a, bucket_t *b);
+void *arena_copy(struct ht_arena *a, const void *src, size_t len);
+void  arena_destroy(struct ht_arena *a);
+
+#endif
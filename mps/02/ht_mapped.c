@@ -0,0 +1,345 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hashtable.h"
+#include "ht_internal.h"
+
+/* Saved images and the read-only backend that maps them. An image is
+   position independent: every reference in it is a byte offset from the
+   start of the file, so it can be mapped anywhere and used without any
+   fixing up. It holds, in order:
+
+     header      magic, hash function, bucket count, entry count, length
+     start[]     nbuckets + 1 entry indexes; bucket i's entries are
+                 entries[start[i]] up to entries[start[i+1]]
+     entries[]   hash, key offset, value offset, key length, grouped by
+                 bucket
+     strings     every key and value, NUL-terminated
+
+   Integers are native-endian 64-bit, so an image only moves between
+   machines of the same byte order. */
+
+#define IMAGE_MAGIC "HTIMG\0\0\2"   /* last byte is the format version */
+
+typedef struct {
+  char magic[8];
+  uint64_t hash_id;     /* see ht_hash_id() */
+  uint64_t nbuckets;    /* a power of two */
+  uint64_t count;
+  uint64_t len;         /* of the whole file */
+} image_hdr_t;
+
+/* ---- ht_save ---- */
+
+typedef struct {
+  char *key;
+  char *val;
+  unsigned long hash;
+  size_t keylen;
+} save_entry_t;
+
+/* the entries ht_save has gathered so far */
+typedef struct {
+  save_entry_t *v;
+  unsigned long n;
+} save_list_t;
+
+static int save_visit(void *ctx, char *key, size_t keylen, void *val) {
+  save_list_t *l = ctx;
+  l->v[l->n].key = key;
+  l->v[l->n].keylen = keylen;
+  l->v[l->n].val = val;
+  l->n++;
+  return 1;
+}
+
+int ht_save(hashtable_t *ht, const char *path) {
+  image_hdr_t hdr;
+  ht_image_entry_t ent;
+  save_entry_t *saving, *order;
+  save_list_t list;
+  unsigned long nsaving;
+  uint64_t *start;
+  unsigned long i, b, mask;
+  uint64_t off;
+  char *tmp;
+  FILE *f;
+  int id = ht_hash_id(ht->hashfn), ok;
+
+  if (id < 0)
+    return -1;
+  list.v = saving = malloc(sizeof(save_entry_t) * (ht->count + 1));
+  list.n = 0;
+  ht->ops->iter(ht, save_visit, &list);
+  nsaving = list.n;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, IMAGE_MAGIC, 8);
+  hdr.hash_id = id;
+  hdr.count = nsaving;
+  /* about one entry per bucket */
+  for (hdr.nbuckets = 1; hdr.nbuckets < nsaving; hdr.nbuckets <<= 1)
+    ;
+  mask = hdr.nbuckets - 1;
+
+  /* counting sort by bucket */
+  start = calloc(sizeof(uint64_t), hdr.nbuckets + 1);
+  for (i = 0; i < nsaving; i++) {
+    saving[i].hash = ht->hashfn(saving[i].key, saving[i].keylen);
+    start[(saving[i].hash & mask) + 1]++;
+  }
+  for (b = 0; b < hdr.nbuckets; b++)
+    start[b + 1] += start[b];
+  order = malloc(sizeof(save_entry_t) * (nsaving + 1));
+  for (i = 0; i < nsaving; i++)
+    order[start[saving[i].hash & mask]++] = saving[i];
+  /* the fill moved every start up to where the next bucket begins */
+  memmove(start + 1, start, sizeof(uint64_t) * hdr.nbuckets);
+  start[0] = 0;
+
+  off = sizeof(hdr) + sizeof(uint64_t) * (hdr.nbuckets + 1)
+    + sizeof(ht_image_entry_t) * nsaving;
+  hdr.len = off;
+  for (i = 0; i < nsaving; i++)
+    hdr.len += order[i].keylen + strlen(order[i].val) + 2;
+
+  /* written beside the target and renamed over it, so a crash never
+     leaves a half-written image and tables already mapping the old one
+     keep working */
+  tmp = malloc(strlen(path) + 5);
+  sprintf(tmp, "%s.tmp", path);
+  ok = (f = fopen(tmp, "wb")) != NULL;
+  if (ok) {
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+      && fwrite(start, sizeof(uint64_t), hdr.nbuckets + 1, f) == hdr.nbuckets + 1;
+    for (i = 0; ok && i < nsaving; i++) {
+      ent.hash = order[i].hash;
+      ent.key = off;
+      ent.keylen = order[i].keylen;
+      off += order[i].keylen + 1;
+      ent.val = off;
+      off += strlen(order[i].val) + 1;
+      ok = fwrite(&ent, sizeof(ent), 1, f) == 1;
+    }
+    for (i = 0; ok && i < nsaving; i++) {
+      ok = fwrite(order[i].key, 1, order[i].keylen, f) == order[i].keylen
+        && fputc('\0', f) == 0
+        && fputs(order[i].val, f) >= 0 && fputc('\0', f) == 0;
+    }
+    ok = fclose(f) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok)
+      unlink(tmp);
+  }
+  free(tmp);
+  free(order);
+  free(start);
+  free(saving);
+  return ok ? 0 : -1;
+}
+
+/* ---- the mapped backend ---- */
+
+static hashtable_t *make_overlay(hashtable_t *ht) {
+  ht_opts_t opts = { 0 };
+  opts.size = 64;
+  opts.max_load = 1;
+  opts.min_load = 0.25;
+  opts.hash = ht->hashfn;
+  return make_hashtable_opts(&opts);
+}
+
+/* every reference the index and entries make stays inside the mapping:
+   bucket ranges run forward within the entries, and each key and value
+   starts in the strings and ends in a NUL before the end of the file. The
+   header must already have passed. */
+static int image_valid(const char *map, const image_hdr_t *hdr) {
+  const uint64_t *start = (const uint64_t *)(hdr + 1);
+  const ht_image_entry_t *e = (const ht_image_entry_t *)(start + hdr->nbuckets + 1);
+  uint64_t strs = (const char *)(e + hdr->count) - map, i;
+  if (start[0] != 0)
+    return 0;
+  for (i = 0; i < hdr->nbuckets; i++) {
+    if (start[i] > start[i + 1])
+      return 0;
+  }
+  for (i = 0; i < hdr->count; i++, e++) {
+    if (e->key < strs || e->key >= hdr->len || e->keylen >= hdr->len - e->key
+        || map[e->key + e->keylen] != '\0'
+        /* the file's last byte is a NUL, so a value can't run off the end */
+        || e->val < strs || e->val >= hdr->len)
+      return 0;
+  }
+  return 1;
+}
+
+hashtable_t *ht_open_mapped(const char *path) {
+  const image_hdr_t *hdr;
+  hashtable_t *ht;
+  struct stat st;
+  void *map;
+  uint64_t nb;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(image_hdr_t)) {
+    close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  /* the header first, then one pass over the index and entries; the
+     strings are only read as lookups reach them */
+  hdr = map;
+  nb = hdr->nbuckets;
+  if (memcmp(hdr->magic, IMAGE_MAGIC, 8) != 0 || hdr->len != (uint64_t)st.st_size
+      || !ht_hash_by_id(hdr->hash_id) || nb == 0 || (nb & (nb - 1)) != 0
+      || nb > (hdr->len - sizeof(*hdr)) / sizeof(uint64_t)
+      || hdr->count > hdr->len / sizeof(ht_image_entry_t)
+      || sizeof(*hdr) + sizeof(uint64_t) * (nb + 1)
+         + sizeof(ht_image_entry_t) * hdr->count > hdr->len
+      || ((const uint64_t *)(hdr + 1))[nb] != hdr->count
+      /* strings can't run off the end of the mapping */
+      || (hdr->count > 0 && ((const char *)map)[hdr->len - 1] != '\0')
+      || !image_valid(map, hdr)) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  ht = calloc(1, sizeof(hashtable_t));
+  ht->backend = HT_MAPPED;
+  ht->ops = &mapped_ops;
+  ht->hashfn = ht_hash_by_id(hdr->hash_id);
+  ht->size = nb;
+  ht->min_size = nb;
+  ht->count = hdr->count;
+  ht->image = map;
+  ht->image_len = st.st_size;
+  ht->image_start = (const uint64_t *)(hdr + 1);
+  ht->image_entries = (const ht_image_entry_t *)(ht->image_start + nb + 1);
+  ht->overlay = make_overlay(ht);
+  return ht;
+}
+
+/* the image entry for key, or NULL */
+static const ht_image_entry_t *image_find(hashtable_t *ht, const char *key,
+                                          size_t len, unsigned long h) {
+  unsigned long b = h & (ht->size - 1), i;
+  const ht_image_entry_t *e;
+  for (i = ht->image_start[b]; i < ht->image_start[b + 1]; i++) {
+    e = &ht->image_entries[i];
+    if (e->hash == h && e->keylen == len && memcmp(ht->image + e->key, key, len) == 0) {
+      ht_note_probe(ht, i - ht->image_start[b] + 1);
+      return e;
+    }
+  }
+  ht_note_probe(ht, i - ht->image_start[b]);
+  return NULL;
+}
+
+/* the overlay uses the image's hash function, so hashes carry over */
+static int live(hashtable_t *ht, bucket_t *ov, const char *key, size_t len,
+                unsigned long h) {
+  return ov ? ov->val != NULL : image_find(ht, key, len, h) != NULL;
+}
+
+static void mapped_put(hashtable_t *ht, char *key, size_t len, void *val,
+                       unsigned long h) {
+  if (!live(ht, chained_find(ht->overlay, key, len, h), key, len, h))
+    ht->count++;
+  ht_put_n(ht->overlay, key, len, val);
+}
+
+static void *mapped_get(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+  bucket_t *ov = chained_find(ht->overlay, key, len, h);
+  const ht_image_entry_t *e;
+  if (ov)
+    return ov->val;
+  e = image_find(ht, key, len, h);
+  return e ? (void *)(ht->image + e->val) : NULL;
+}
+
+static void mapped_del(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+  bucket_t *ov = chained_find(ht->overlay, key, len, h);
+  char *k;
+  if (!live(ht, ov, key, len, h))
+    return;
+  ht->count--;
+  if (image_find(ht, key, len, h)) {
+    /* the image can't change, so hide its entry behind a tombstone */
+    k = malloc(len + 1);
+    memcpy(k, key, len);
+    k[len] = '\0';
+    ht_put_n(ht->overlay, k, len, NULL);
+  } else {
+    ht_del_n(ht->overlay, key, len);
+  }
+}
+
+/* the overlay's live entries go straight to the caller's visitor */
+typedef struct {
+  ht_visit_fn visit;
+  void *ctx;
+  int aborted;
+} mapped_walk_t;
+
+static int overlay_visit(void *ctx, char *key, size_t keylen, void *val) {
+  mapped_walk_t *w = ctx;
+  if (val && !w->visit(w->ctx, key, keylen, val)) {
+    w->aborted = 1;
+    return 0;
+  }
+  return 1;
+}
+
+static void mapped_iter(hashtable_t *ht, ht_visit_fn visit, void *ctx) {
+  mapped_walk_t w = { visit, ctx, 0 };
+  const ht_image_entry_t *e;
+  unsigned long i;
+  ht->overlay->ops->iter(ht->overlay, overlay_visit, &w);
+  if (w.aborted)
+    return; // abort iteration
+  for (i = 0; i < ht->image_start[ht->size]; i++) {
+    e = &ht->image_entries[i];
+    /* entries the overlay has replaced or deleted were visited above */
+    if (chained_find(ht->overlay, ht->image + e->key, e->keylen, e->hash))
+      continue;
+    if (!visit(ctx, (char *)ht->image + e->key, e->keylen, (char *)ht->image + e->val))
+      return; // abort iteration
+  }
+}
+
+/* the image's layout is fixed; only the overlay can be resized */
+static void mapped_rehash(hashtable_t *ht, unsigned long newsize) {
+  ht_rehash(ht->overlay, newsize);
+}
+
+static void mapped_rehash_incremental(hashtable_t *ht, unsigned long newsize) {
+  ht_rehash_incremental(ht->overlay, newsize);
+}
+
+/* the bucket's entry range; the entries themselves follow it closely */
+static void mapped_prefetch(hashtable_t *ht, const unsigned long *hashes, int n) {
+  int i;
+  for (i = 0; i < n; i++)
+    __builtin_prefetch(&ht->image_start[hashes[i] & (ht->size - 1)]);
+}
+
+static void mapped_destroy(hashtable_t *ht) {
+  free_hashtable(ht->overlay);
+  munmap((void *)ht->image, ht->image_len);
+  free(ht);
+}
+
+const struct ht_ops mapped_ops = {
+  mapped_put, mapped_get, mapped_del, mapped_iter, mapped_rehash,
+  mapped_rehash_incremental, mapped_destroy, NULL, mapped_prefetch
+};
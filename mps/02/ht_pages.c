@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "hashtable.h"
+#include "ht_internal.h"
+
+/* The tables' big arrays: chained bucket arrays, open-addressed slot,
+   control and index arrays, and huge-page arena slabs. A table made with
+   opts.huge_pages asks for each array that fills a huge page to be
+   backed by huge pages, so a lookup anywhere in it misses the TLB far
+   less often. First choice is a MAP_HUGETLB mapping from the reserved
+   pool (vm.nr_hugepages), which is usually empty; then an anonymous
+   mapping aligned to a huge page boundary and marked MADV_HUGEPAGE, which
+   transparent huge pages may or may not honour; then the heap. Anything
+   smaller, or made without the option, comes from the heap.
+
+   Each array is preceded by a header saying where it came from, so one
+   call frees any of them. The header is a cache line, so arrays start
+   cache line aligned whenever the memory under them is. */
+
+#define ARRAY_HDR HT_ARRAY_HDR
+#define WANT_HUGE(huge, bytes) ((huge) && (bytes) + ARRAY_HDR >= HT_HUGE_PAGE)
+
+typedef struct {
+  size_t map_len;   /* of the whole mapping; 0 if it's heap */
+  int pages;        /* HT_PAGES_* */
+} array_hdr_t;
+
+static void *map_huge(size_t len, array_hdr_t *hdr) {
+  char *p, *aligned;
+  size_t lead;
+  len = (len + HT_HUGE_PAGE - 1) & ~(HT_HUGE_PAGE - 1);
+#ifdef MAP_HUGETLB
+  p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p != MAP_FAILED) {
+    hdr->map_len = len;
+    hdr->pages = HT_PAGES_HUGETLB;
+    return p;
+  }
+#endif
+#ifdef MADV_HUGEPAGE
+  /* over-map by a page, then trim both ends back to an aligned run */
+  p = mmap(NULL, len + HT_HUGE_PAGE, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p != MAP_FAILED) {
+    aligned = (char *)(((uintptr_t)p + HT_HUGE_PAGE - 1) & ~(uintptr_t)(HT_HUGE_PAGE - 1));
+    lead = aligned - p;
+    if (lead) {
+      munmap(p, lead);
+    }
+    munmap(aligned + len, HT_HUGE_PAGE - lead);
+    hdr->map_len = len;
+    hdr->pages = madvise(aligned, len, MADV_HUGEPAGE) == 0 ? HT_PAGES_THP : HT_PAGES_SMALL;
+    return aligned;
+  }
+#endif
+  return NULL;
+}
+
+/* zeroed, like calloc */
+void *ht_array_alloc(size_t bytes, int huge) {
+  array_hdr_t hdr = { 0, HT_PAGES_SMALL };
+  char *p = NULL;
+  if (WANT_HUGE(huge, bytes)) {
+    p = map_huge(bytes + ARRAY_HDR, &hdr);
+  }
+  if (!p) {
+    hdr.map_len = 0;
+    hdr.pages = HT_PAGES_SMALL;
+    p = calloc(1, bytes + ARRAY_HDR);
+  }
+  memcpy(p, &hdr, sizeof(hdr));
+  return p + ARRAY_HDR;
+}
+
+/* the first min(old, new) bytes are kept; anything past them is zeroed */
+void *ht_array_realloc(void *p, size_t old_bytes, size_t bytes, int huge) {
+  array_hdr_t *hdr = (array_hdr_t *)((char *)p - ARRAY_HDR);
+  char *q;
+  if (hdr->map_len == 0 && !WANT_HUGE(huge, bytes)) {
+    q = realloc(hdr, bytes + ARRAY_HDR);
+    if (bytes > old_bytes) {
+      memset(q + ARRAY_HDR + old_bytes, 0, bytes - old_bytes);
+    }
+    return q + ARRAY_HDR;
+  }
+  q = ht_array_alloc(bytes, huge);
+  memcpy(q, p, old_bytes < bytes ? old_bytes : bytes);
+  ht_array_free(p);
+  return q;
+}
+
+void ht_array_free(void *p) {
+  array_hdr_t *hdr;
+  if (!p) {
+    return;
+  }
+  hdr = (array_hdr_t *)((char *)p - ARRAY_HDR);
+  if (hdr->map_len) {
+    munmap(hdr, hdr->map_len);
+  } else {
+    free(hdr);
+  }
+}
+
+int ht_array_pages(const void *p) {
+  return ((const array_hdr_t *)((const char *)p - ARRAY_HDR))->pages;
+}
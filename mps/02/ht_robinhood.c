@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable.h"
+#include "ht_internal.h"
+
+/* Open addressing with Robin Hood probing: on insert, an entry that has
+   travelled further from its home slot than the current occupant takes the
+   slot and the occupant moves on. Probe lengths stay short and even, and a
+   lookup can stop as soon as it meets an entry closer to home than itself.
+   Deletes shift the following run back by one instead of leaving
+   tombstones, so delete-heavy workloads don't slowly fill the array. */
+
+/* grow once the array is 90% full */
+#define RH_MAX_LOAD_NUM 9
+#define RH_MAX_LOAD_DEN 10
+#define RH_MIN_SLOTS 8
+
+#define RH_MASK(ht) ((ht)->size - 1)
+#define RH_HOME(ht, h) ((h) & RH_MASK(ht))
+
+/* slot count is kept a power of two so the home slot is a mask, not a mod */
+static unsigned long rh_capacity(unsigned long want) {
+  unsigned long cap = RH_MIN_SLOTS;
+  while (cap < want)
+    cap <<= 1;
+  return cap;
+}
+
+static int rh_too_full(unsigned long count, unsigned long size) {
+  return count * RH_MAX_LOAD_DEN > size * RH_MAX_LOAD_NUM;
+}
+
+static unsigned long rh_probe_len(hashtable_t *ht, unsigned long idx) {
+  return (idx - RH_HOME(ht, ht->slots[idx].hash)) & RH_MASK(ht);
+}
+
+void rh_init(hashtable_t *ht, unsigned long size) {
+  ht->size = rh_capacity(size);
+  ht->slots = ht_array_alloc(sizeof(ht_slot_t) * ht->size, ht->huge_pages);
+  ht->count = 0;
+}
+
+/* places an entry known not to be in the table */
+static void rh_insert(hashtable_t *ht, unsigned long h, char *key, size_t len,
+                      void *val) {
+  ht_slot_t cur = { h, key, val, len }, tmp;
+  unsigned long idx = RH_HOME(ht, h), dist = 0, d;
+  while (ht->slots[idx].key) {
+    d = rh_probe_len(ht, idx);
+    if (d < dist) {
+      /* the occupant is richer; steal its slot and carry it forward */
+      tmp = ht->slots[idx];
+      ht->slots[idx] = cur;
+      cur = tmp;
+      dist = d;
+    }
+    idx = (idx + 1) & RH_MASK(ht);
+    dist++;
+  }
+  ht->slots[idx] = cur;
+  ht->count++;
+}
+
+/* returns the slot index holding key, or -1 */
+static long rh_find(hashtable_t *ht, unsigned long h, const char *key, size_t len) {
+  unsigned long idx = RH_HOME(ht, h), dist = 0;
+  long found = -1;
+  while (ht->slots[idx].key) {
+    /* anything we're looking for would have displaced this entry */
+    if (rh_probe_len(ht, idx) < dist)
+      break;
+    if (ht->slots[idx].hash == h && ht->slots[idx].keylen == len
+        && memcmp(ht->slots[idx].key, key, len) == 0) {
+      found = idx;
+      break;
+    }
+    idx = (idx + 1) & RH_MASK(ht);
+    dist++;
+  }
+  /* the slot that settled it counts too */
+  ht_note_probe(ht, dist + 1);
+  return found;
+}
+
+static void rh_resize(hashtable_t *ht, unsigned long newsize) {
+  ht_slot_t *old = ht->slots;
+  unsigned long i, old_size = ht->size;
+  ht->stats.rehashes++;
+  ht->size = newsize;
+  ht->slots = ht_array_alloc(sizeof(ht_slot_t) * newsize, ht->huge_pages);
+  ht->count = 0;
+  /* stored hashes mean we never rehash the keys themselves */
+  for (i = 0; i < old_size; i++) {
+    if (old[i].key)
+      rh_insert(ht, old[i].hash, old[i].key, old[i].keylen, old[i].val);
+  }
+  ht_array_free(old);
+}
+
+static void rh_put(hashtable_t *ht, char *key, size_t len, void *val, unsigned long h) {
+  long idx = rh_find(ht, h, key, len);
+  if (idx >= 0) {
+    /* update entry */
+    free(ht->slots[idx].key);
+    free(ht->slots[idx].val);
+    ht->slots[idx].key = key;
+    ht->slots[idx].val = val;
+    return;
+  }
+  if (rh_too_full(ht->count + 1, ht->size))
+    rh_resize(ht, ht->size << 1);
+  rh_insert(ht, h, key, len, val);
+}
+
+static void *rh_get(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+  long idx = rh_find(ht, h, key, len);
+  return idx >= 0 ? ht->slots[idx].val : NULL;
+}
+
+static void rh_del(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+  long idx = rh_find(ht, h, key, len);
+  unsigned long cur, next;
+  if (idx < 0)
+    return;
+  free(ht->slots[idx].key);
+  free(ht->slots[idx].val);
+  /* backward shift: pull the rest of the run one slot closer to home */
+  cur = idx;
+  next = (cur + 1) & RH_MASK(ht);
+  while (ht->slots[next].key && rh_probe_len(ht, next) > 0) {
+    ht->slots[cur] = ht->slots[next];
+    cur = next;
+    next = (cur + 1) & RH_MASK(ht);
+  }
+  memset(&ht->slots[cur], 0, sizeof(ht_slot_t));
+  ht->count--;
+}
+
+static void rh_iter(hashtable_t *ht, ht_visit_fn visit, void *ctx) {
+  unsigned long i;
+  ht_slot_t *s;
+  for (i = 0; i < ht->size; i++) {
+    s = &ht->slots[i];
+    if (s->key && !visit(ctx, s->key, s->keylen, s->val))
+      return; // abort iteration
+  }
+}
+
+static void rh_rehash(hashtable_t *ht, unsigned long newsize) {
+  unsigned long cap = rh_capacity(newsize);
+  /* never shrink below what the current entries need */
+  while (rh_too_full(ht->count, cap))
+    cap <<= 1;
+  if (cap != ht->size)
+    rh_resize(ht, cap);
+}
+
+static void rh_destroy(hashtable_t *ht) {
+  unsigned long i;
+  for (i = 0; i < ht->size; i++) {
+    if (ht->slots[i].key) {
+      free(ht->slots[i].key);
+      free(ht->slots[i].val);
+    }
+  }
+  ht_array_free(ht->slots);
+  free(ht);
+}
+
+/* probes are short, so the home slot's line is nearly all a lookup reads */
+static void rh_prefetch(hashtable_t *ht, const unsigned long *hashes, int n) {
+  int i;
+  for (i = 0; i < n; i++)
+    __builtin_prefetch(&ht->slots[RH_HOME(ht, hashes[i])]);
+}
+
+const struct ht_ops robinhood_ops = {
+  /* slots can't be split across two arrays, so resizes are always whole */
+  rh_put, rh_get, rh_del, rh_iter, rh_rehash, rh_rehash, rh_destroy,
+  rh_probe_len, rh_prefetch
+};
@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable.h"
+#include "ht_internal.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Swiss-table style open addressing. Alongside the slot array sits one
+   control byte per slot: EMPTY, DELETED, or the low 7 bits of the entry's
+   hash (h2) with the top bit clear. Slots are probed in aligned groups of
+   16; one SSE2 compare of a group's control bytes against h2 gives a
+   bitmask of candidate slots, so most lookups touch a single key, and a
+   group with an EMPTY byte ends the probe. The high hash bits (h1) pick
+   the first group, and later groups follow a triangular sequence, which
+   visits every group when the group count is a power of two. */
+
+#define GROUP     16
+#define CT_EMPTY   ((unsigned char)0x80)
+#define CT_DELETED ((unsigned char)0xFE)
+#define IS_FULL(c) (((c) & 0x80) == 0)
+
+#define H1(h) ((h) >> 7)
+#define H2(h) ((unsigned char)((h) & 0x7F))
+
+/* slots may fill to 7/8, counting tombstones */
+#define SW_MAX_LOAD(cap) ((cap) - (cap) / 8)
+
+#define NGROUPS(ht) ((ht)->size / GROUP)
+
+/* ---- group matching: bit i of the result is set if byte i matches ---- */
+
+#ifdef __SSE2__
+
+static inline unsigned match_byte(const unsigned char *g, unsigned char b) {
+  __m128i ctrl = _mm_load_si128((const __m128i *)g);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b)));
+}
+
+/* EMPTY and DELETED are the only bytes with the top bit set */
+static inline unsigned match_free(const unsigned char *g) {
+  return _mm_movemask_epi8(_mm_load_si128((const __m128i *)g));
+}
+
+#else
+
+static inline unsigned match_byte(const unsigned char *g, unsigned char b) {
+  unsigned mask = 0;
+  int i;
+  for (i = 0; i < GROUP; i++) {
+    if (g[i] == b)
+      mask |= 1u << i;
+  }
+  return mask;
+}
+
+static inline unsigned match_free(const unsigned char *g) {
+  unsigned mask = 0;
+  int i;
+  for (i = 0; i < GROUP; i++) {
+    if (g[i] & 0x80)
+      mask |= 1u << i;
+  }
+  return mask;
+}
+
+#endif
+
+static unsigned long sw_capacity(unsigned long want) {
+  unsigned long cap = GROUP;
+  while (cap < want)
+    cap <<= 1;
+  return cap;
+}
+
+static void sw_alloc(hashtable_t *ht, unsigned long cap) {
+  ht->size = cap;
+  ht->slots = ht_array_alloc(sizeof(ht_slot_t) * cap, ht->huge_pages);
+  /* 16-byte aligned, as ht_array_alloc's arrays are, so each group is a
+     single aligned load */
+  ht->ctrl = ht_array_alloc(cap, ht->huge_pages);
+  memset(ht->ctrl, CT_EMPTY, cap);
+  ht->count = 0;
+  ht->growth_left = SW_MAX_LOAD(cap);
+}
+
+void sw_init(hashtable_t *ht, unsigned long size) {
+  sw_alloc(ht, sw_capacity(size));
+}
+
+/* first slot on h's probe sequence that's EMPTY or DELETED */
+static unsigned long sw_find_free(hashtable_t *ht, unsigned long h) {
+  unsigned long mask = NGROUPS(ht) - 1, g = H1(h) & mask, step = 0;
+  unsigned free_bits;
+  for (;;) {
+    free_bits = match_free(ht->ctrl + g * GROUP);
+    if (free_bits)
+      return g * GROUP + __builtin_ctz(free_bits);
+    g = (g + ++step) & mask;
+  }
+}
+
+static void sw_set(hashtable_t *ht, unsigned long idx, unsigned long h,
+                   char *key, size_t len, void *val) {
+  ht->ctrl[idx] = H2(h);
+  ht->slots[idx].hash = h;
+  ht->slots[idx].key = key;
+  ht->slots[idx].val = val;
+  ht->slots[idx].keylen = len;
+}
+
+static void sw_resize(hashtable_t *ht, unsigned long cap) {
+  ht_slot_t *old = ht->slots;
+  unsigned char *old_ctrl = ht->ctrl;
+  unsigned long i, idx, old_size = ht->size, n = ht->count;
+  ht->stats.rehashes++;
+  sw_alloc(ht, cap);
+  /* stored hashes mean we never rehash the keys themselves */
+  for (i = 0; i < old_size; i++) {
+    if (IS_FULL(old_ctrl[i])) {
+      idx = sw_find_free(ht, old[i].hash);
+      sw_set(ht, idx, old[i].hash, old[i].key, old[i].keylen, old[i].val);
+    }
+  }
+  ht->count = n;
+  ht->growth_left -= n;
+  ht_array_free(old);
+  ht_array_free(old_ctrl);
+}
+
+/* returns the slot holding key, or -1 */
+static long sw_find(hashtable_t *ht, unsigned long h, const char *key, size_t len) {
+  unsigned long mask = NGROUPS(ht) - 1, g = H1(h) & mask, step = 0;
+  unsigned char *grp;
+  unsigned bits;
+  ht_slot_t *s;
+  int i;
+  for (;;) {
+    grp = ht->ctrl + g * GROUP;
+    bits = match_byte(grp, H2(h));
+    while (bits) {
+      i = __builtin_ctz(bits);
+      s = &ht->slots[g * GROUP + i];
+      if (s->hash == h && s->keylen == len && memcmp(s->key, key, len) == 0) {
+        ht_note_probe(ht, step + 1);
+        return g * GROUP + i;
+      }
+      bits &= bits - 1;
+    }
+    /* an EMPTY byte means the key was never pushed past this group */
+    if (match_byte(grp, CT_EMPTY)) {
+      ht_note_probe(ht, step + 1);
+      return -1;
+    }
+    g = (g + ++step) & mask;
+  }
+}
+
+static void sw_put(hashtable_t *ht, char *key, size_t len, void *val, unsigned long h) {
+  long found = sw_find(ht, h, key, len);
+  unsigned long idx;
+  if (found >= 0) {
+    /* update entry */
+    free(ht->slots[found].key);
+    free(ht->slots[found].val);
+    ht->slots[found].key = key;
+    ht->slots[found].val = val;
+    return;
+  }
+  idx = sw_find_free(ht, h);
+  if (ht->ctrl[idx] == CT_EMPTY && ht->growth_left == 0) {
+    /* out of room: grow if really full, else just clear out tombstones */
+    sw_resize(ht, ht->count + 1 > SW_MAX_LOAD(ht->size) / 2 ? ht->size * 2 : ht->size);
+    idx = sw_find_free(ht, h);
+  }
+  if (ht->ctrl[idx] == CT_EMPTY)
+    ht->growth_left--;
+  sw_set(ht, idx, h, key, len, val);
+  ht->count++;
+}
+
+static void *sw_get(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+  long idx = sw_find(ht, h, key, len);
+  return idx >= 0 ? ht->slots[idx].val : NULL;
+}
+
+static void sw_del(hashtable_t *ht, const char *key, size_t len, unsigned long h) {
+  long idx = sw_find(ht, h, key, len);
+  unsigned char *grp;
+  if (idx < 0)
+    return;
+  free(ht->slots[idx].key);
+  free(ht->slots[idx].val);
+  memset(&ht->slots[idx], 0, sizeof(ht_slot_t));
+  /* groups are aligned, so an insert never probes past a group that still
+     has an EMPTY byte; such a slot can go straight back to EMPTY */
+  grp = ht->ctrl + (idx & ~(unsigned long)(GROUP - 1));
+  if (match_byte(grp, CT_EMPTY)) {
+    ht->ctrl[idx] = CT_EMPTY;
+    ht->growth_left++;
+  } else {
+    ht->ctrl[idx] = CT_DELETED;
+  }
+  ht->count--;
+}
+
+static void sw_iter(hashtable_t *ht, ht_visit_fn visit, void *ctx) {
+  unsigned long i;
+  ht_slot_t *s;
+  for (i = 0; i < ht->size; i++) {
+    s = &ht->slots[i];
+    if (IS_FULL(ht->ctrl[i]) && !visit(ctx, s->key, s->keylen, s->val))
+      return; // abort iteration
+  }
+}
+
+static void sw_rehash(hashtable_t *ht, unsigned long newsize) {
+  unsigned long cap = sw_capacity(newsize);
+  /* never shrink below what the current entries need */
+  while (ht->count > SW_MAX_LOAD(cap))
+    cap <<= 1;
+  sw_resize(ht, cap);
+}
+
+static void sw_destroy(hashtable_t *ht) {
+  unsigned long i;
+  for (i = 0; i < ht->size; i++) {
+    if (IS_FULL(ht->ctrl[i])) {
+      free(ht->slots[i].key);
+      free(ht->slots[i].val);
+    }
+  }
+  ht_array_free(ht->slots);
+  ht_array_free(ht->ctrl);
+  free(ht);
+}
+
+/* groups probed before the one holding slot idx */
+static unsigned long sw_probe_len(hashtable_t *ht, unsigned long idx) {
+  unsigned long mask = NGROUPS(ht) - 1, g = H1(ht->slots[idx].hash) & mask;
+  unsigned long step = 0;
+  while (g != idx / GROUP)
+    g = (g + ++step) & mask;
+  return step;
+}
+
+/* the first group's control bytes, and the slot h2 is most likely to
+   match in (the group's first cache line of slots) */
+static void sw_prefetch(hashtable_t *ht, const unsigned long *hashes, int n) {
+  unsigned long g;
+  int i;
+  for (i = 0; i < n; i++) {
+    g = H1(hashes[i]) & (NGROUPS(ht) - 1);
+    __builtin_prefetch(ht->ctrl + g * GROUP);
+    __builtin_prefetch(&ht->slots[g * GROUP]);
+  }
+}
+
+const struct ht_ops swiss_ops = {
+  sw_put, sw_get, sw_del, sw_iter, sw_rehash, sw_rehash, sw_destroy,
+  sw_probe_len, sw_prefetch
+};
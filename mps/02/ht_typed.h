@@ -0,0 +1,194 @@
+#ifndef HT_TYPED_H
+#define HT_TYPED_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable.h"
+
+/* HT_DEFINE(name, key_t, val_t, hashfn, eqfn) writes out a table for one
+   key and value type, for maps that would otherwise format integers into
+   strings and allocate every value:
+
+     name_t *name_new(unsigned long size);
+     void    name_free(name_t *t);
+     void    name_put(name_t *t, key_t key, val_t val);
+     val_t  *name_get(name_t *t, key_t key);  NULL if absent; good until
+                                              the next put or del
+     int     name_del(name_t *t, key_t key);  1 if the key was there
+     void    name_iter(name_t *t, int (*visit)(void *ctx, key_t key,
+                       val_t *val), void *ctx);  stops when visit returns 0
+
+   hashfn(key) gives an unsigned long and eqfn(a, b) is nonzero for equal
+   keys; either may be a macro. Probing is Robin Hood with backward-shift
+   deletes, as in ht_robinhood.c, but keys and values are stored in the
+   slots and copied by assignment, so nothing is allocated per entry and
+   nothing is ever freed: pointers put in stay the caller's. Each slot's
+   distance from home is kept in a byte array beside the slots instead of
+   a stored hash, so a miss usually ends after reading a byte or two.
+   Distances past 254 all read 255; only runs that long (a poor hash)
+   compare more keys than they need to. Tables grow past 7/8 full and
+   never shrink.
+
+   Fixed-size keys that aren't scalars go in a struct, hashed and compared
+   with ht_hash_bytes and ht_eq_bytes; zero such keys before filling them
+   in, so padding compares equal. */
+
+#define HT_TYPED_MAX_LOAD_NUM 7
+#define HT_TYPED_MAX_LOAD_DEN 8
+#define HT_TYPED_MIN_SLOTS 8
+
+/* integer keys are often sequential or share low bits, and the mask only
+   keeps the low ones; murmur3's finalizer spreads every bit into them */
+static inline unsigned long ht_hash_u64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+#define ht_eq_scalar(a, b) ((a) == (b))
+#define ht_hash_bytes(k) ht_hash_wy(&(k), sizeof(k))
+#define ht_eq_bytes(a, b) (memcmp(&(a), &(b), sizeof(a)) == 0)
+
+#define HT_DEFINE(name, key_t, val_t, hashfn, eqfn)                         \
+typedef struct {                                                            \
+  key_t key;                                                                \
+  val_t val;                                                                \
+} name##_slot_t;                                                            \
+                                                                            \
+typedef struct {                                                            \
+  name##_slot_t *slots;                                                     \
+  unsigned char *dist;      /* probe length + 1, so 0 is an empty slot */   \
+  unsigned long size;       /* a power of two */                            \
+  unsigned long count;                                                      \
+} name##_t;                                                                 \
+                                                                            \
+static inline void name##_alloc(name##_t *t, unsigned long size) {          \
+  t->size = size;                                                           \
+  t->slots = malloc(sizeof(name##_slot_t) * size);                          \
+  t->dist = calloc(size, 1);                                                \
+  t->count = 0;                                                             \
+}                                                                           \
+                                                                            \
+static inline name##_t *name##_new(unsigned long size) {                    \
+  name##_t *t = malloc(sizeof(name##_t));                                   \
+  unsigned long cap = HT_TYPED_MIN_SLOTS;                                   \
+  while (cap < size)                                                        \
+    cap <<= 1;                                                              \
+  name##_alloc(t, cap);                                                     \
+  return t;                                                                 \
+}                                                                           \
+                                                                            \
+static inline void name##_free(name##_t *t) {                               \
+  free(t->slots);                                                           \
+  free(t->dist);                                                            \
+  free(t);                                                                  \
+}                                                                           \
+                                                                            \
+/* places an entry known not to be in the table */                          \
+static inline void name##_insert(name##_t *t, name##_slot_t s) {            \
+  unsigned long mask = t->size - 1, idx = hashfn(s.key) & mask;             \
+  unsigned d = 1, td;                                                       \
+  name##_slot_t tmp;                                                        \
+  while (t->dist[idx]) {                                                    \
+    if (t->dist[idx] < d) {                                                 \
+      /* the occupant is richer; steal its slot and carry it forward */     \
+      tmp = t->slots[idx];                                                  \
+      t->slots[idx] = s;                                                    \
+      s = tmp;                                                              \
+      td = t->dist[idx];                                                    \
+      t->dist[idx] = d;                                                     \
+      d = td;                                                               \
+    }                                                                       \
+    idx = (idx + 1) & mask;                                                 \
+    d += d < UCHAR_MAX;                                                     \
+  }                                                                         \
+  t->slots[idx] = s;                                                        \
+  t->dist[idx] = d;                                                         \
+  t->count++;                                                               \
+}                                                                           \
+                                                                            \
+static inline void name##_resize(name##_t *t, unsigned long newsize) {      \
+  name##_slot_t *old = t->slots;                                            \
+  unsigned char *old_dist = t->dist;                                        \
+  unsigned long i, old_size = t->size;                                      \
+  name##_alloc(t, newsize);                                                 \
+  for (i = 0; i < old_size; i++) {                                          \
+    if (old_dist[i])                                                        \
+      name##_insert(t, old[i]);                                             \
+  }                                                                         \
+  free(old);                                                                \
+  free(old_dist);                                                           \
+}                                                                           \
+                                                                            \
+/* returns the slot index holding key, or -1 */                             \
+static inline long name##_find(name##_t *t, key_t key) {                    \
+  unsigned long mask = t->size - 1, idx = hashfn(key) & mask;               \
+  unsigned d = 1;                                                           \
+  /* anything we're looking for would have displaced a closer entry, */     \
+  /* and only entries as far from home as we are share our home slot */     \
+  while (t->dist[idx] >= d) {                                               \
+    if (t->dist[idx] == d && eqfn(t->slots[idx].key, key))                  \
+      return idx;                                                           \
+    idx = (idx + 1) & mask;                                                 \
+    d += d < UCHAR_MAX;                                                     \
+  }                                                                         \
+  return -1;                                                                \
+}                                                                           \
+                                                                            \
+static inline void name##_put(name##_t *t, key_t key, val_t val) {          \
+  long idx = name##_find(t, key);                                           \
+  name##_slot_t s;                                                          \
+  if (idx >= 0) {                                                           \
+    t->slots[idx].val = val;                                                \
+    return;                                                                 \
+  }                                                                         \
+  if ((t->count + 1) * HT_TYPED_MAX_LOAD_DEN > t->size * HT_TYPED_MAX_LOAD_NUM) \
+    name##_resize(t, t->size << 1);                                         \
+  s.key = key;                                                              \
+  s.val = val;                                                              \
+  name##_insert(t, s);                                                      \
+}                                                                           \
+                                                                            \
+static inline val_t *name##_get(name##_t *t, key_t key) {                   \
+  long idx = name##_find(t, key);                                           \
+  return idx >= 0 ? &t->slots[idx].val : NULL;                              \
+}                                                                           \
+                                                                            \
+static inline int name##_del(name##_t *t, key_t key) {                      \
+  long idx = name##_find(t, key);                                           \
+  unsigned long mask = t->size - 1, cur, next, d;                           \
+  if (idx < 0)                                                              \
+    return 0;                                                               \
+  /* backward shift: pull the rest of the run one slot closer to home */    \
+  cur = idx;                                                                \
+  next = (cur + 1) & mask;                                                  \
+  while (t->dist[next] > 1) {                                               \
+    t->slots[cur] = t->slots[next];                                         \
+    d = t->dist[next];                                                      \
+    if (d == UCHAR_MAX) /* saturated; work out how far it really is */      \
+      d = ((next - hashfn(t->slots[next].key)) & mask) + 1;                 \
+    t->dist[cur] = d - 1 < UCHAR_MAX ? d - 1 : UCHAR_MAX;                   \
+    cur = next;                                                             \
+    next = (cur + 1) & mask;                                                \
+  }                                                                         \
+  t->dist[cur] = 0;                                                         \
+  t->count--;                                                               \
+  return 1;                                                                 \
+}                                                                           \
+                                                                            \
+static inline void name##_iter(name##_t *t,                                 \
+                               int (*visit)(void *, key_t, val_t *),        \
+                               void *ctx) {                                 \
+  unsigned long i;                                                          \
+  for (i = 0; i < t->size; i++) {                                           \
+    if (t->dist[i] && !visit(ctx, t->slots[i].key, &t->slots[i].val))       \
+      return; /* abort iteration */                                         \
+  }                                                                         \
+}
+
+#endif
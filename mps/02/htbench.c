@@ -0,0 +1,750 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hashtable.h"
+#include "ht_internal.h"
+#include "ht_typed.h"
+#include "trace.h"
+
+/* Benchmarks the hashtable backends against each other. Every tracefile
+   named on the command line is replayed with output suppressed, then a
+   synthetic workload of N random keys is run: insert them all, look them
+   all up in a different order, look up N keys that aren't there, and
+   delete them all. Once 90% are deleted, one ht_iter over what's left is
+   timed per remaining entry, since that's when a table is at its
+   sparsest. The inserts and hits are repeated through
+   ht_put_many/ht_get_many in batches of BATCH keys. Then N fixed-width
+   binary IDs go through ht_put_n/ht_get_n, N uint64_t -> uint64_t pairs
+   go through each backend and an HT_DEFINE table, and a skewed get-or-fill
+   workload runs through cache tables holding a quarter of the keys. Then
+   a writer thread's throughput is measured while the main thread keeps
+   scanning an N-entry chained table, with and without ht_snapshot. Then
+   an N-entry chained table is doubled by ht_rehash_parallel on 1, 2, 4...
+   threads, up to the online cores. Then N entries are loaded by ht_put,
+   by ht_put_many and by ht_build on one thread and on every core. Last,
+   N-entry tables are built with and without huge pages and looked up in
+   random order, hits and misses both, where TLB misses show most. */
+
+typedef struct {
+  const char *name;
+  ht_opts_t opts;
+} config_t;
+
+static config_t configs[] = {
+  { "chained",      { .backend = HT_CHAINED } },
+  { "chained/wy",   { .backend = HT_CHAINED, .hash = ht_hash_wy } },
+  { "robinhood",    { .backend = HT_ROBINHOOD } },
+  { "robinhood/wy", { .backend = HT_ROBINHOOD, .hash = ht_hash_wy } },
+  { "swiss",        { .backend = HT_SWISS } },
+  { "swiss/wy",     { .backend = HT_SWISS, .hash = ht_hash_wy } },
+  { "compact",      { .backend = HT_COMPACT } },
+  { "compact/wy",   { .backend = HT_COMPACT, .hash = ht_hash_wy } },
+  { "chained/bloom", { .backend = HT_CHAINED, .bloom = 1 } },
+  { "swiss/bloom",  { .backend = HT_SWISS, .bloom = 1 } },
+};
+#define NCONFIGS (sizeof(configs) / sizeof(configs[0]))
+
+/* keys per ht_get_many/ht_put_many call, about a request handler's worth */
+#define BATCH 64
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static hashtable_t *make_table(config_t *c, unsigned long size) {
+  ht_opts_t opts = c->opts;
+  opts.size = size;
+  return make_hashtable_opts(&opts);
+}
+
+/* seconds to replay the trace rounds times, each on a fresh table */
+static double replay(config_t *c, trace_t *t, int rounds) {
+  hashtable_t *ht;
+  trace_op_t op;
+  unsigned long i;
+  double start, total = 0;
+  int r;
+  for (r = 0; r < rounds; r++) {
+    ht = make_table(c, t->size);
+    start = now();
+    for (i = 0; i < t->nops; i++) {
+      op = trace_op(t, i);
+      switch (op.type) {
+      case 'p':
+        ht_put(ht, strdup(op.key), strdup(op.val));
+        break;
+      case 'g':
+        ht_get(ht, op.key);
+        break;
+      case 'd':
+        ht_del(ht, op.key);
+        break;
+      case 'r':
+        ht_rehash(ht, op.n);
+        break;
+      case 'R':
+        ht_rehash_incremental(ht, op.n);
+        break;
+      }
+    }
+    total += now() - start;
+    free_hashtable(ht);
+  }
+  return total;
+}
+
+static char **random_keys(unsigned long n, char first) {
+  static const char alpha[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  char **keys = malloc(sizeof(char *) * n);
+  unsigned long i;
+  int len, j;
+  for (i = 0; i < n; i++) {
+    len = 8 + rand() % 17;
+    keys[i] = malloc(len + 1);
+    /* distinct first characters keep hit and miss keys apart; the index
+       suffix keeps keys within a set distinct */
+    keys[i][0] = first;
+    for (j = 1; j < len; j++) {
+      keys[i][j] = alpha[rand() % (sizeof(alpha) - 1)];
+    }
+    keys[i][len] = '\0';
+    snprintf(keys[i] + len - 7, 8, "%07lu", i % 10000000);
+  }
+  return keys;
+}
+
+static void shuffle(char **keys, unsigned long n) {
+  unsigned long i, j;
+  char *tmp;
+  for (i = n - 1; i > 0; i--) {
+    j = rand() % (i + 1);
+    tmp = keys[i];
+    keys[i] = keys[j];
+    keys[j] = tmp;
+  }
+}
+
+/* seconds to insert keys through ht_put_many, then to look them up in
+   order through ht_get_many */
+static void batched(hashtable_t *ht, char **keys, char **order, unsigned long n,
+                    double *put_secs, double *get_secs) {
+  char *k[BATCH];
+  void *v[BATCH];
+  unsigned long i, j, m, found = 0;
+  double t0, t1, t2;
+  t0 = now();
+  for (i = 0; i < n; i += m) {
+    m = n - i < BATCH ? n - i : BATCH;
+    /* copied like the one-at-a-time inserts, so the columns compare */
+    for (j = 0; j < m; j++) {
+      k[j] = strdup(keys[i + j]);
+      v[j] = strdup("v");
+    }
+    ht_put_many(ht, k, v, m);
+  }
+  t1 = now() - t0;
+  t0 = now();
+  for (i = 0; i < n; i += m) {
+    m = n - i < BATCH ? n - i : BATCH;
+    ht_get_many(ht, order + i, m, v);
+    for (j = 0; j < m; j++) {
+      found += v[j] != NULL;
+    }
+  }
+  t2 = now() - t0;
+  if (found != n) {
+    printf("batched: wrong results (%lu found)\n", found);
+  }
+  *put_secs = t1;
+  *get_secs = t2;
+}
+
+static int count_iter(char *key, void *val) {
+  return 1;
+}
+
+static void synthetic(unsigned long n) {
+  char **keys = random_keys(n, 'k'), **misses = random_keys(n, 'm');
+  char **order = malloc(sizeof(char *) * n);
+  hashtable_t *ht;
+  unsigned long i, found, sparse = n - n / 10;
+  double t0, t1, t2, t3, t4, ti, bput, bget;
+  unsigned c;
+
+  memcpy(order, keys, sizeof(char *) * n);
+  shuffle(order, n);
+  printf("\nsynthetic, %lu keys (ns/op)\n", n);
+  printf("%-14s %10s %10s %10s %10s %10s %10s %10s\n", "backend", "insert", "hit", "miss",
+         "delete", "iter", "put_many", "get_many");
+  for (c = 0; c < NCONFIGS; c++) {
+    ht = make_table(&configs[c], n);
+    found = 0;
+    t0 = now();
+    for (i = 0; i < n; i++) {
+      ht_put(ht, strdup(keys[i]), strdup("v"));
+    }
+    t1 = now();
+    for (i = 0; i < n; i++) {
+      found += ht_get(ht, order[i]) != NULL;
+    }
+    t2 = now();
+    for (i = 0; i < n; i++) {
+      found += ht_get(ht, misses[i]) != NULL;
+    }
+    t3 = now();
+    for (i = 0; i < sparse; i++) {
+      ht_del(ht, order[i]);
+    }
+    ti = now();
+    ht_iter(ht, count_iter);
+    ti = now() - ti;
+    for (; i < n; i++) {
+      ht_del(ht, order[i]);
+    }
+    t4 = now() - ti;
+    if (found != n || ht->count != 0) {
+      printf("%s: wrong results (%lu found, %lu left)\n", configs[c].name,
+             found, ht->count);
+    }
+    free_hashtable(ht);
+    ht = make_table(&configs[c], n);
+    batched(ht, keys, order, n, &bput, &bget);
+    free_hashtable(ht);
+    printf("%-14s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", configs[c].name,
+           (t1 - t0) / n * 1e9, (t2 - t1) / n * 1e9,
+           (t3 - t2) / n * 1e9, (t4 - t3) / n * 1e9,
+           n > sparse ? ti / (n - sparse) * 1e9 : 0.0,
+           bput / n * 1e9, bget / n * 1e9);
+  }
+
+  for (i = 0; i < n; i++) {
+    free(keys[i]);
+    free(misses[i]);
+  }
+  free(keys);
+  free(misses);
+  free(order);
+}
+
+/* IDW-byte IDs, as a network layer hands them over: raw bytes, NULs and
+   all, so only the length-carrying calls can take them */
+#define IDW 16
+
+static void binary_ids(unsigned long n) {
+  unsigned char *ids = malloc(n * IDW), *misses = malloc(n * IDW);
+  hashtable_t *ht;
+  unsigned long i, found;
+  double t0, t1, t2, t3;
+  unsigned c;
+  char *k;
+
+  for (i = 0; i < n * IDW; i++) {
+    ids[i] = rand();
+    misses[i] = rand();
+  }
+  /* the index in the first bytes keeps IDs distinct; the last byte keeps
+     hits and misses apart */
+  for (i = 0; i < n; i++) {
+    memcpy(ids + i * IDW, &i, sizeof(i));
+    memcpy(misses + i * IDW, &i, sizeof(i));
+    ids[i * IDW + IDW - 1] = 0;
+    misses[i * IDW + IDW - 1] = 1;
+  }
+  printf("\n%d-byte binary IDs, %lu keys (ns/op)\n", IDW, n);
+  printf("%-14s %10s %10s %10s\n", "backend", "insert", "hit", "miss");
+  for (c = 0; c < NCONFIGS; c++) {
+    ht = make_table(&configs[c], n);
+    found = 0;
+    t0 = now();
+    for (i = 0; i < n; i++) {
+      k = malloc(IDW);
+      memcpy(k, ids + i * IDW, IDW);
+      ht_put_n(ht, k, IDW, strdup("v"));
+    }
+    t1 = now();
+    for (i = 0; i < n; i++) {
+      found += ht_get_n(ht, (char *)ids + i * IDW, IDW) != NULL;
+    }
+    t2 = now();
+    for (i = 0; i < n; i++) {
+      found += ht_get_n(ht, (char *)misses + i * IDW, IDW) != NULL;
+    }
+    t3 = now();
+    if (found != n) {
+      printf("%s: wrong results (%lu found)\n", configs[c].name, found);
+    }
+    free_hashtable(ht);
+    printf("%-14s %10.1f %10.1f %10.1f\n", configs[c].name, (t1 - t0) / n * 1e9,
+           (t2 - t1) / n * 1e9, (t3 - t2) / n * 1e9);
+  }
+  free(ids);
+  free(misses);
+}
+
+HT_DEFINE(u64map, uint64_t, uint64_t, ht_hash_u64, ht_eq_scalar)
+
+/* A uint64_t -> uint64_t map, kept the way the generic table has to keep
+   it: each key and value copied to the heap, the key as 8 raw bytes */
+static void u64_keys(unsigned long n) {
+  uint64_t *keys = malloc(sizeof(uint64_t) * n), *v;
+  hashtable_t *ht;
+  u64map_t *t;
+  unsigned long i, found;
+  double t0, t1, t2, t3, t4;
+  unsigned c;
+
+  /* rand() leaves the top bit clear, so setting it makes a miss */
+  for (i = 0; i < n; i++) {
+    keys[i] = ((uint64_t)rand() << 32) | i;
+  }
+  printf("\nuint64_t -> uint64_t, %lu keys (ns/op)\n", n);
+  printf("%-14s %10s %10s %10s %10s\n", "backend", "insert", "hit", "miss", "delete");
+  for (c = 0; c < NCONFIGS; c++) {
+    ht = make_table(&configs[c], n);
+    found = 0;
+    t0 = now();
+    for (i = 0; i < n; i++) {
+      v = malloc(sizeof(uint64_t));
+      *v = i;
+      ht_put_n(ht, memcpy(malloc(sizeof(uint64_t)), &keys[i], sizeof(uint64_t)),
+               sizeof(uint64_t), v);
+    }
+    t1 = now();
+    for (i = 0; i < n; i++) {
+      v = ht_get_n(ht, (char *)&keys[i], sizeof(uint64_t));
+      found += v && *v == i;
+    }
+    t2 = now();
+    for (i = 0; i < n; i++) {
+      keys[i] |= 1ULL << 63;
+      found += ht_get_n(ht, (char *)&keys[i], sizeof(uint64_t)) != NULL;
+      keys[i] &= ~(1ULL << 63);
+    }
+    t3 = now();
+    for (i = 0; i < n; i++) {
+      ht_del_n(ht, (char *)&keys[i], sizeof(uint64_t));
+    }
+    t4 = now();
+    if (found != n || ht->count != 0) {
+      printf("%s: wrong results (%lu found, %lu left)\n", configs[c].name,
+             found, ht->count);
+    }
+    free_hashtable(ht);
+    printf("%-14s %10.1f %10.1f %10.1f %10.1f\n", configs[c].name, (t1 - t0) / n * 1e9,
+           (t2 - t1) / n * 1e9, (t3 - t2) / n * 1e9, (t4 - t3) / n * 1e9);
+  }
+
+  t = u64map_new(n);
+  found = 0;
+  t0 = now();
+  for (i = 0; i < n; i++) {
+    u64map_put(t, keys[i], i);
+  }
+  t1 = now();
+  for (i = 0; i < n; i++) {
+    v = u64map_get(t, keys[i]);
+    found += v && *v == i;
+  }
+  t2 = now();
+  for (i = 0; i < n; i++) {
+    found += u64map_get(t, keys[i] | 1ULL << 63) != NULL;
+  }
+  t3 = now();
+  for (i = 0; i < n; i++) {
+    u64map_del(t, keys[i]);
+  }
+  t4 = now();
+  if (found != n || t->count != 0) {
+    printf("HT_DEFINE: wrong results (%lu found, %lu left)\n", found, t->count);
+  }
+  u64map_free(t);
+  printf("%-14s %10.1f %10.1f %10.1f %10.1f\n", "HT_DEFINE", (t1 - t0) / n * 1e9,
+         (t2 - t1) / n * 1e9, (t3 - t2) / n * 1e9, (t4 - t3) / n * 1e9);
+  free(keys);
+}
+
+/* Get, and put on a miss, over 4N accesses skewed towards low-numbered
+   keys (the cube of a uniform draw), with room for N/4 entries. */
+static void cache_policies(unsigned long n) {
+  static const struct { const char *name; unsigned long cap; ht_evict_t evict; } caches[] = {
+    { "unbounded", 0, HT_EVICT_LRU }, { "lru", 4, HT_EVICT_LRU },
+    { "clock", 4, HT_EVICT_CLOCK },
+  };
+  char **keys = random_keys(n, 'k');
+  unsigned long *seq = malloc(sizeof(unsigned long) * 4 * n), i, hits;
+  hashtable_t *ht;
+  ht_opts_t opts;
+  double u, t0, t1;
+  unsigned c;
+
+  for (i = 0; i < 4 * n; i++) {
+    u = (double)rand() / ((double)RAND_MAX + 1);
+    seq[i] = u * u * u * n;
+  }
+  printf("\ncache of %lu keys, skewed get-or-fill\n", n / 4);
+  printf("%-14s %10s %10s\n", "cache", "ns/op", "hit%");
+  for (c = 0; c < sizeof(caches) / sizeof(caches[0]); c++) {
+    memset(&opts, 0, sizeof(opts));
+    opts.size = n / 4;
+    opts.max_load = 1;
+    opts.capacity = caches[c].cap ? n / caches[c].cap : 0;
+    opts.evict = caches[c].evict;
+    ht = make_hashtable_opts(&opts);
+    hits = 0;
+    t0 = now();
+    for (i = 0; i < 4 * n; i++) {
+      if (ht_get(ht, keys[seq[i]])) {
+        hits++;
+      } else {
+        ht_put(ht, strdup(keys[seq[i]]), strdup("v"));
+      }
+    }
+    t1 = now();
+    free_hashtable(ht);
+    printf("%-14s %10.1f %10.1f\n", caches[c].name, (t1 - t0) / (4 * n) * 1e9,
+           100.0 * hits / (4 * n));
+  }
+  for (i = 0; i < n; i++) {
+    free(keys[i]);
+  }
+  free(keys);
+  free(seq);
+}
+
+/* how long each scan_writers mode runs */
+#define SCAN_SECS 0.5
+
+typedef struct {
+  hashtable_t *ht;
+  pthread_mutex_t lock;     /* held for every call on ht */
+  char **keys;
+  unsigned long n;
+  atomic_int stop;
+  unsigned long writes;
+} scan_bench_t;
+
+/* deletes and puts back keys in turn, so the table stays the same size */
+static void *scan_writer(void *arg) {
+  scan_bench_t *s = arg;
+  unsigned long i = 0;
+  char *k, *v;
+  while (!atomic_load(&s->stop)) {
+    if (i & 1) {
+      k = strdup(s->keys[(i >> 1) % s->n]);
+      v = strdup("w");
+      pthread_mutex_lock(&s->lock);
+      ht_put(s->ht, k, v);
+      pthread_mutex_unlock(&s->lock);
+    } else {
+      pthread_mutex_lock(&s->lock);
+      ht_del(s->ht, s->keys[(i >> 1) % s->n]);
+      pthread_mutex_unlock(&s->lock);
+    }
+    i++;
+  }
+  s->writes = i;
+  return NULL;
+}
+
+/* Every call on the table is made under one mutex, as a table shared
+   between threads is used today. "locked" scans with ht_iter holding it,
+   so the writer waits out each scan; "snapshot" holds it only to take and
+   release an ht_snapshot, and scans that. "none" is the writer alone. */
+static void scan_writers(unsigned long n) {
+  static const char *modes[] = { "none", "locked", "snapshot" };
+  char **keys = random_keys(n, 'k');
+  scan_bench_t s;
+  hashtable_t *snap;
+  pthread_t writer;
+  unsigned long i, scans;
+  double t0, secs, scan_secs;
+  unsigned c, m;
+
+  printf("\nwriter during full scans, %lu keys\n", n);
+  printf("%-14s %-10s %10s %10s %10s\n", "backend", "scan", "write_Mops", "scans",
+         "ms/scan");
+  for (c = 0; c < NCONFIGS; c++) {
+    if (configs[c].opts.backend != HT_CHAINED) {
+      continue;
+    }
+    for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+      s.ht = make_table(&configs[c], n);
+      for (i = 0; i < n; i++) {
+        ht_put(s.ht, strdup(keys[i]), strdup("v"));
+      }
+      pthread_mutex_init(&s.lock, NULL);
+      s.keys = keys;
+      s.n = n;
+      atomic_store(&s.stop, 0);
+      pthread_create(&writer, NULL, scan_writer, &s);
+      scans = 0;
+      scan_secs = 0;
+      t0 = now();
+      while ((secs = now() - t0) < SCAN_SECS) {
+        if (m == 0) {
+          usleep(1000);
+          continue;
+        }
+        secs = now();
+        pthread_mutex_lock(&s.lock);
+        if (m == 1) {
+          ht_iter(s.ht, count_iter);
+          pthread_mutex_unlock(&s.lock);
+        } else {
+          snap = ht_snapshot(s.ht);
+          pthread_mutex_unlock(&s.lock);
+          ht_iter(snap, count_iter);
+          pthread_mutex_lock(&s.lock);
+          ht_release_snapshot(snap);
+          pthread_mutex_unlock(&s.lock);
+        }
+        scan_secs += now() - secs;
+        scans++;
+      }
+      atomic_store(&s.stop, 1);
+      pthread_join(writer, NULL);
+      pthread_mutex_destroy(&s.lock);
+      free_hashtable(s.ht);
+      printf("%-14s %-10s %10.2f %10lu %10.1f\n", configs[c].name, modes[m],
+             s.writes / secs / 1e6, scans, scans ? scan_secs / scans * 1e3 : 0.0);
+    }
+  }
+  for (i = 0; i < n; i++) {
+    free(keys[i]);
+  }
+  free(keys);
+}
+
+/* each thread count's time is the best of this many resizes */
+#define REHASH_ROUNDS 3
+
+static void rehash_scaling(unsigned long n, int max_threads) {
+  char **keys = random_keys(n, 'k');
+  int nthreads, r;
+  hashtable_t *ht = make_hashtable(n);
+  double t0, secs, best, base = 0;
+  unsigned long i;
+
+  for (i = 0; i < n; i++) {
+    ht_put(ht, strdup(keys[i]), strdup("v"));
+  }
+  printf("\nparallel rehash, %lu keys, %lu -> %lu buckets\n", n, n, 2 * n);
+  printf("%-14s %10s %10s\n", "threads", "ms", "speedup");
+  for (nthreads = 1; ; nthreads = nthreads * 2 < max_threads ? nthreads * 2 : max_threads) {
+    best = 0;
+    for (r = 0; r < REHASH_ROUNDS; r++) {
+      t0 = now();
+      ht_rehash_parallel(ht, 2 * n, nthreads);
+      secs = now() - t0;
+      if (best == 0 || secs < best) {
+        best = secs;
+      }
+      ht_rehash(ht, n);
+    }
+    if (nthreads == 1) {
+      base = best;
+    }
+    printf("%-14d %10.1f %10.2f\n", nthreads, best * 1e3, base / best);
+    if (nthreads >= max_threads) {
+      break;
+    }
+  }
+  if (ht_get(ht, keys[n / 2]) == NULL || ht->count != n) {
+    printf("parallel rehash: wrong results (%lu left)\n", ht->count);
+  }
+  free_hashtable(ht);
+  for (i = 0; i < n; i++) {
+    free(keys[i]);
+  }
+  free(keys);
+}
+
+/* Loads a chained table sized for n, as a nightly reference load would;
+   the keys are copied beforehand, so only the load itself is timed. The
+   hit column shows what the resulting layout does for lookups. */
+static void bulk_build(unsigned long n, int max_threads) {
+  static const char *modes[] = { "ht_put", "ht_put_many", "ht_build/1", "ht_build/all" };
+  char **keys = random_keys(n, 'k'), **order = malloc(sizeof(char *) * n);
+  char **k = malloc(sizeof(char *) * n);
+  void **v = malloc(sizeof(void *) * n);
+  ht_opts_t opts = { .backend = HT_CHAINED };
+  hashtable_t *ht;
+  unsigned long i, found;
+  double t0, t1, t2;
+  unsigned m;
+
+  memcpy(order, keys, sizeof(char *) * n);
+  shuffle(order, n);
+  opts.size = n;
+  printf("\nbulk load, %lu keys\n", n);
+  printf("%-14s %10s %10s\n", "load", "ms", "hit_ns");
+  for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    for (i = 0; i < n; i++) {
+      k[i] = strdup(keys[i]);
+      v[i] = strdup("v");
+    }
+    t0 = now();
+    if (m == 0) {
+      ht = make_hashtable_opts(&opts);
+      for (i = 0; i < n; i++) {
+        ht_put(ht, k[i], v[i]);
+      }
+    } else if (m == 1) {
+      ht = make_hashtable_opts(&opts);
+      ht_put_many(ht, k, v, n);
+    } else {
+      ht = ht_build(&opts, k, v, n, m == 2 ? 1 : max_threads);
+    }
+    t1 = now();
+    found = 0;
+    for (i = 0; i < n; i++) {
+      found += ht_get(ht, order[i]) != NULL;
+    }
+    t2 = now();
+    if (found != n || ht->count != n) {
+      printf("%s: wrong results (%lu found, %lu in table)\n", modes[m], found, ht->count);
+    }
+    free_hashtable(ht);
+    printf("%-14s %10.1f %10.1f\n", modes[m], (t1 - t0) * 1e3, (t2 - t1) / n * 1e9);
+  }
+  for (i = 0; i < n; i++) {
+    free(keys[i]);
+  }
+  free(keys);
+  free(order);
+  free(k);
+  free(v);
+}
+
+static void huge_pages(unsigned long n) {
+  static const char *kinds[] = { "none", "thp", "hugetlb" };
+  static const config_t tables[] = {
+    { "chained",      { .backend = HT_CHAINED } },
+    { "chained/arena", { .backend = HT_CHAINED, .arena = 1 } },
+    { "robinhood",    { .backend = HT_ROBINHOOD } },
+    { "swiss",        { .backend = HT_SWISS } },
+    { "compact",      { .backend = HT_COMPACT } },
+  };
+  char **keys = random_keys(n, 'k'), **misses = random_keys(n, 'm');
+  char **order = malloc(sizeof(char *) * n);
+  config_t c;
+  hashtable_t *ht;
+  const void *arr;
+  unsigned long i, found;
+  double t0, t1, t2, t3;
+  unsigned t;
+  int huge;
+
+  memcpy(order, keys, sizeof(char *) * n);
+  shuffle(order, n);
+  printf("\nhuge pages, %lu keys, random order (ns/op)\n", n);
+  printf("%-14s %8s %10s %10s %10s\n", "backend", "pages", "insert", "hit", "miss");
+  for (t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+    for (huge = 0; huge < 2; huge++) {
+      c = tables[t];
+      c.opts.huge_pages = huge;
+      ht = make_table(&c, n);
+      found = 0;
+      t0 = now();
+      for (i = 0; i < n; i++) {
+        if (c.opts.arena) {
+          ht_put_copy(ht, keys[i], "v", 2);
+        } else {
+          ht_put(ht, strdup(keys[i]), strdup("v"));
+        }
+      }
+      t1 = now();
+      for (i = 0; i < n; i++) {
+        found += ht_get(ht, order[i]) != NULL;
+      }
+      t2 = now();
+      for (i = 0; i < n; i++) {
+        found += ht_get(ht, misses[i]) != NULL;
+      }
+      t3 = now();
+      if (found != n) {
+        printf("%s: wrong results (%lu found)\n", c.name, found);
+      }
+      arr = ht->backend == HT_CHAINED ? (const void *)ht->buckets
+        : ht->backend == HT_COMPACT ? (const void *)ht->index : (const void *)ht->slots;
+      printf("%-14s %8s %10.1f %10.1f %10.1f\n", c.name, kinds[ht_array_pages(arr)],
+             (t1 - t0) / n * 1e9, (t2 - t1) / n * 1e9, (t3 - t2) / n * 1e9);
+      free_hashtable(ht);
+    }
+  }
+  for (i = 0; i < n; i++) {
+    free(keys[i]);
+    free(misses[i]);
+  }
+  free(keys);
+  free(misses);
+  free(order);
+}
+
+static void usage(char *prog) {
+  printf("Usage: %s [-n KEYS] [-r ROUNDS] [-t MAX_THREADS] [TRACEFILE_NAME...]\n", prog);
+  printf("  -n  keys in the synthetic workload (default 1000000, 0 skips it)\n");
+  printf("  -r  times each tracefile is replayed (default 10)\n");
+  printf("  -t  most threads a parallel rehash or ht_build gets (default: online cores)\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long nkeys = 1000000;
+  int c, rounds = 10, max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned i;
+  trace_t *t;
+  double secs;
+
+  while ((c = getopt(argc, argv, "n:r:t:")) != -1) {
+    switch (c) {
+    case 'n':
+      nkeys = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      rounds = atoi(optarg);
+      break;
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (rounds < 1 || max_threads < 1) {
+    usage(argv[0]);
+  }
+  srand(351);
+
+  for (; optind < argc; optind++) {
+    if ((t = load_trace(argv[optind])) == NULL) {
+      exit(1);
+    }
+    printf("%s, %lu ops x %d\n", argv[optind], t->nops, rounds);
+    printf("%-14s %10s %10s\n", "backend", "Mops/s", "ns/op");
+    for (i = 0; i < NCONFIGS; i++) {
+      secs = replay(&configs[i], t, rounds);
+      printf("%-14s %10.2f %10.1f\n", configs[i].name,
+             t->nops * rounds / secs / 1e6, secs / (t->nops * rounds) * 1e9);
+    }
+    free_trace(t);
+  }
+  if (nkeys > 0) {
+    synthetic(nkeys);
+    binary_ids(nkeys);
+    u64_keys(nkeys);
+    cache_policies(nkeys);
+    scan_writers(nkeys);
+    rehash_scaling(nkeys, max_threads);
+    bulk_build(nkeys, max_threads);
+    huge_pages(nkeys);
+  }
+  return 0;
+}
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hashtable.h"
+#include "trace.h"
+
+/* Compiles a text tracefile into the binary form described in trace.h,
+   which load_trace maps and replays in place with nothing to parse. Every
+   distinct key and value goes into the string pool once, with its hash
+   under the chosen function (-H, default djb2) worked out here, so a
+   table using that function never hashes a key during the replay. */
+
+static trace_str_t *strs;
+static unsigned long nstrs, strs_cap;
+static char *pool;
+static size_t pool_len, pool_cap;
+static ht_hash_fn hashfn = ht_hash_djb2;
+
+/* the entry index for s, adding it to the pool the first time it's seen;
+   ids maps each string to its index, kept in the table's arena. Records
+   hold 32-bit indexes, which is plenty for a trace that fits in memory. */
+static uint32_t intern(hashtable_t *ids, const char *s, size_t len) {
+  uint32_t *id = ht_get_n(ids, s, len), n;
+  if (id) {
+    return *id;
+  }
+  if (nstrs > UINT32_MAX) {
+    printf("More than %u distinct strings\n", UINT32_MAX);
+    exit(1);
+  }
+  if (nstrs == strs_cap) {
+    strs_cap = strs_cap ? strs_cap * 2 : 1024;
+    strs = realloc(strs, sizeof(trace_str_t) * strs_cap);
+  }
+  while (pool_len + len + 1 > pool_cap) {
+    pool_cap = pool_cap ? pool_cap * 2 : 64 * 1024;
+    pool = realloc(pool, pool_cap);
+  }
+  strs[nstrs].hash = hashfn(s, len);
+  strs[nstrs].off = pool_len;
+  strs[nstrs].len = len;
+  memcpy(pool + pool_len, s, len + 1);
+  pool_len += len + 1;
+  n = nstrs++;
+  ht_put_copy(ids, s, &n, sizeof(n));
+  return n;
+}
+
+static void usage(char *prog) {
+  printf("Usage: %s [-H djb2|wy] TRACEFILE_NAME OUTFILE\n", prog);
+  printf("  -H  hash function to precompute key hashes with (default djb2);\n"
+         "      tables using another one hash keys as usual\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  ht_opts_t opts = { .size = 1024, .max_load = 1, .arena = 1 };
+  trace_file_t hdr;
+  trace_rec_t *recs;
+  trace_op_t op;
+  hashtable_t *ids;
+  trace_t *t;
+  unsigned long i;
+  FILE *out;
+  int c, ok;
+
+  while ((c = getopt(argc, argv, "H:")) != -1) {
+    switch (c) {
+    case 'H':
+      if (strcmp(optarg, "djb2") == 0) {
+        hashfn = ht_hash_djb2;
+      } else if (strcmp(optarg, "wy") == 0) {
+        hashfn = ht_hash_wy;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (argc - optind != 2) {
+    usage(argv[0]);
+  }
+  if ((t = load_trace(argv[optind])) == NULL) {
+    exit(1);
+  }
+  if (t->hashfn) {
+    printf("%s is already compiled\n", argv[optind]);
+    exit(1);
+  }
+  ids = make_hashtable_opts(&opts);
+  /* zeroed, so the padding after the last record is too */
+  recs = calloc(t->nops + 1, sizeof(trace_rec_t));
+  for (i = 0; i < t->nops; i++) {
+    op = trace_op(t, i);
+    recs[i].type = op.type;
+    if (op.key) {
+      recs[i].key = intern(ids, op.key, op.keylen);
+    }
+    if (op.type == 'p') {
+      recs[i].arg = intern(ids, op.val, strlen(op.val));
+    } else if (op.type == 'r' || op.type == 'R') {
+      if (op.n > UINT32_MAX) {
+        printf("Rehash to %lu buckets is too big to compile\n", op.n);
+        exit(1);
+      }
+      recs[i].arg = op.n;
+    }
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+  hdr.size = t->size;
+  hdr.nops = t->nops;
+  hdr.nstrs = nstrs;
+  hdr.pool_len = pool_len;
+  hdr.hash = ht_hash_id(hashfn);
+  if ((out = fopen(argv[optind + 1], "wb")) == NULL) {
+    printf("Error opening %s\n", argv[optind + 1]);
+    exit(1);
+  }
+  ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1
+    && fwrite(recs, 1, TRACE_RECS_BYTES(t->nops), out) == TRACE_RECS_BYTES(t->nops)
+    && fwrite(strs, sizeof(trace_str_t), nstrs, out) == nstrs
+    && fwrite(pool, 1, pool_len, out) == pool_len;
+  if (fclose(out) != 0 || !ok) {
+    printf("Error writing %s\n", argv[optind + 1]);
+    exit(1);
+  }
+  printf("%lu ops, %lu distinct strings, %lu bytes\n", t->nops, nstrs,
+         (unsigned long)(sizeof(hdr) + TRACE_RECS_BYTES(t->nops)
+                         + sizeof(trace_str_t) * nstrs + pool_len));
+  free_hashtable(ids);
+  free_trace(t);
+  free(recs);
+  free(strs);
+  free(pool);
+  return 0;
+}
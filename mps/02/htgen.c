@@ -0,0 +1,222 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Writes a synthetic tracefile in main.c's format to stdout. Operations
+   draw keys from a fixed universe of KEYS names, either uniformly or with
+   Zipfian skew so a few hot keys take most of the traffic. Each key's
+   name is a pure function of its index and the seed, so a key can be
+   regenerated whenever it's drawn without keeping a table of names, and
+   the same flags always give the same trace. */
+
+static unsigned long nkeys = 10000, nops = 100000, table_size;
+static int min_len = 8, max_len = 16;
+static int pct_put = 20, pct_get = 75, pct_del = 5;
+static double theta;            /* Zipf exponent; 0 is uniform */
+static int nrehash;             /* rehash directives spread over the trace */
+static char rehash_kind = 'r';
+static unsigned long seed = 351;
+
+/* splitmix64: cheap, well mixed, and seekable by its input */
+static unsigned long mix(unsigned long x) {
+  x += 0x9e3779b97f4a7c15UL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+  return x ^ (x >> 31);
+}
+
+static unsigned long rng_state;
+
+static unsigned long rng(void) {
+  return mix(rng_state++);
+}
+
+/* uniform in [0, 1) */
+static double rng_unit(void) {
+  return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* key i's name; its length is uniform in [min_len, max_len] */
+static void key_name(unsigned long i, char *buf) {
+  static const char alpha[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  unsigned long r = mix(i ^ (seed << 32));
+  int len = min_len + r % (max_len - min_len + 1), j, n = 0;
+  /* the index in base 62 keeps names distinct, and main makes sure
+     min_len characters can spell it; the rest is filler */
+  do {
+    buf[n++] = alpha[i % 62];
+    i /= 62;
+  } while (i && n < len);
+  for (j = n; j < len; j++) {
+    r = mix(r);
+    buf[j] = alpha[r % (sizeof(alpha) - 1)];
+  }
+  buf[len] = '\0';
+}
+
+/* 1 if every index below n can be spelled in len base-62 digits */
+static int names_fit(unsigned long n, int len) {
+  unsigned long room = 1;
+  while (len-- > 0 && room < n) {
+    room = room > ULONG_MAX / 62 ? ULONG_MAX : room * 62;
+  }
+  return room >= n;
+}
+
+/* Zipf-distributed ranks in [0, nkeys), after Gray et al., "Quickly
+   Generating Billion-Record Synthetic Databases" (SIGMOD '94), as used
+   by YCSB. zeta(n) is summed once up front. */
+static double zipf_zetan, zipf_eta, zipf_alpha;
+
+static void zipf_init(void) {
+  double zeta2 = 0;
+  unsigned long i;
+  zipf_zetan = 0;
+  for (i = 1; i <= nkeys; i++) {
+    zipf_zetan += 1.0 / pow((double)i, theta);
+  }
+  for (i = 1; i <= 2; i++) {
+    zeta2 += 1.0 / pow((double)i, theta);
+  }
+  zipf_alpha = 1.0 / (1.0 - theta);
+  zipf_eta = (1.0 - pow(2.0 / nkeys, 1.0 - theta)) / (1.0 - zeta2 / zipf_zetan);
+}
+
+static unsigned long zipf_next(void) {
+  double u = rng_unit(), uz = u * zipf_zetan;
+  unsigned long r;
+  if (uz < 1.0) {
+    return 0;
+  }
+  if (uz < 1.0 + pow(0.5, theta)) {
+    return 1;
+  }
+  r = (unsigned long)(nkeys * pow(zipf_eta * u - zipf_eta + 1.0, zipf_alpha));
+  return r < nkeys ? r : nkeys - 1;
+}
+
+/* which key an operation uses. Zipf ranks are scattered over the key
+   indexes so hot keys aren't all neighbours in the universe; multiplying
+   by a prime that doesn't divide nkeys is a permutation, so every key
+   still gets its own rank */
+#define SCATTER 2654435761UL
+
+static unsigned long pick_key(void) {
+  if (theta == 0) {
+    return rng() % nkeys;
+  }
+  return (zipf_next() * SCATTER + seed) % nkeys;
+}
+
+static void usage(char *prog) {
+  printf("Usage: %s [-n KEYS] [-o OPS] [-l MIN:MAX] [-z THETA] [-m PUT:GET:DEL]\n"
+         "       [-r REHASHES] [-I] [-t SIZE] [-s SEED]\n", prog);
+  printf("  -n  distinct keys operations draw from (default 10000)\n");
+  printf("  -o  operations to write (default 100000)\n");
+  printf("  -l  key lengths, uniform between MIN and MAX (default 8:16); MIN\n"
+         "      characters must be enough to tell KEYS keys apart\n");
+  printf("  -z  Zipf skew of key popularity, 0 <= THETA < 1 (default 0, uniform)\n");
+  printf("  -m  percentages of puts, gets and deletes (default 20:75:5)\n");
+  printf("  -r  rehash directives spread evenly over the trace (default 0)\n");
+  printf("  -I  make those incremental rehashes (R rather than r)\n");
+  printf("  -t  initial table size (default KEYS)\n");
+  printf("  -s  random seed (default 351)\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  char *key = NULL;
+  unsigned long i, k, next_rehash, every = 0, live = 0, size;
+  unsigned char *present;
+  int c, which;
+
+  while ((c = getopt(argc, argv, "n:o:l:z:m:r:It:s:")) != -1) {
+    switch (c) {
+    case 'n':
+      nkeys = strtoul(optarg, NULL, 10);
+      break;
+    case 'o':
+      nops = strtoul(optarg, NULL, 10);
+      break;
+    case 'l':
+      if (sscanf(optarg, "%d:%d", &min_len, &max_len) != 2) {
+        usage(argv[0]);
+      }
+      break;
+    case 'z':
+      theta = atof(optarg);
+      break;
+    case 'm':
+      if (sscanf(optarg, "%d:%d:%d", &pct_put, &pct_get, &pct_del) != 3) {
+        usage(argv[0]);
+      }
+      break;
+    case 'r':
+      nrehash = atoi(optarg);
+      break;
+    case 'I':
+      rehash_kind = 'R';
+      break;
+    case 't':
+      table_size = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      seed = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (nkeys < 1 || min_len < 1 || max_len < min_len || theta < 0 || theta >= 1
+      || pct_put < 0 || pct_get < 0 || pct_del < 0 || pct_put + pct_get + pct_del != 100
+      || nrehash < 0) {
+    usage(argv[0]);
+  }
+  if (!names_fit(nkeys, min_len)) {
+    fprintf(stderr, "%lu keys need names longer than %d characters; raise -l MIN\n",
+            nkeys, min_len);
+    exit(1);
+  }
+  rng_state = mix(seed);
+  if (theta > 0) {
+    zipf_init();
+  }
+  size = table_size ? table_size : nkeys;
+  /* tracks which keys are in the table, so rehashes can be sized to it */
+  present = calloc(1, nkeys);
+  key = malloc(max_len + 1);
+  if (nrehash > 0) {
+    every = nops / (nrehash + 1);
+  }
+  next_rehash = every;
+
+  printf("%lu\n", size);
+  for (i = 0; i < nops; i++) {
+    if (every && i == next_rehash && nrehash-- > 0) {
+      /* about one entry per bucket, never empty */
+      printf("%c %lu\n", rehash_kind, live ? live : 1);
+      next_rehash += every;
+    }
+    which = rng() % 100;
+    k = pick_key();
+    key_name(k, key);
+    if (which < pct_put) {
+      printf("p %s v%lx\n", key, rng() & 0xffffff);
+      live += !present[k];
+      present[k] = 1;
+    } else if (which < pct_put + pct_get) {
+      printf("g %s\n", key);
+    } else {
+      printf("d %s\n", key);
+      live -= present[k];
+      present[k] = 0;
+    }
+  }
+  free(key);
+  free(present);
+  return 0;
+}
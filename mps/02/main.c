@@ -1,7 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
 #include "hashtable.h"
+#include "ht_internal.h"
+#include "shashtable.h"
+#include "trace.h"
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-result" 
@@ -11,11 +17,51 @@ int print_iter(char *key, void *val) {
   return 1;
 }
 
-void print_ht_stats(hashtable_t *ht) {
+/* options for every table the driver makes; see usage() */
+static ht_opts_t opts;
+static const char *hash_name = "djb2";
+static int verbose;
+static char *save_path;     /* -S: write the table here when the trace ends */
+static char *map_path;      /* -M: start from this image instead of empty */
+static int quiet;           /* -q: time the trace instead of narrating it */
+static unsigned int jobs;   /* -j: replay on this many shards in parallel */
+
+/* slots an open-addressed table has in use; compact ones only fill a prefix */
+static unsigned long open_slots(hashtable_t *ht) {
+  return ht->backend == HT_COMPACT ? ht->nentries : ht->size;
+}
+
+static void print_open_stats(hashtable_t *ht) {
+  unsigned long idx, len, max_len=0, num_entries=0, total_len=0;
+  for (idx=0; idx<open_slots(ht); idx++) {
+    if (!ht->slots[idx].key) {
+      continue;
+    }
+    len = ht_probe_len(ht, idx);
+    num_entries++;
+    total_len += len;
+    if (max_len < len) {
+      max_len = len;
+    }
+  }
+  printf("Num entries = %lu\n", num_entries);
+  printf("Max probe length = %lu\n", max_len);
+  printf("Avg probe length = %0.2f\n",
+         num_entries ? (float)total_len / num_entries : 0.0);
+}
+
+static void print_chain_stats(hashtable_t *ht) {
   bucket_t *b;
   unsigned long idx, len, max_len=0, num_buckets=0, num_chains=0;
-  for (idx=0; idx<ht->size; idx++) {
-    b = ht->buckets[idx];
+  /* during an incremental rehash, chains not yet moved are still in old_buckets */
+  for (idx=0; idx<ht->size+ht->old_size; idx++) {
+    if (idx < ht->size) {
+      b = ht->buckets[idx];
+    } else if (idx - ht->size >= ht->migrate_pos) {
+      b = ht->old_buckets[idx - ht->size];
+    } else {
+      continue;
+    }
     len = 0;
     while (b) {
       len++;
@@ -32,12 +78,464 @@ void print_ht_stats(hashtable_t *ht) {
   printf("Num buckets = %lu\n", num_buckets);
   printf("Max chain length = %lu\n", max_len);
   printf("Avg chain length = %0.2f\n", (float)num_buckets / num_chains);
+  if (ht->old_buckets) {
+    printf("Migrated %lu/%lu old buckets\n", ht->migrate_pos, ht->old_size);
+  }
+}
+
+static void print_mapped_stats(hashtable_t *ht) {
+  unsigned long idx, len, max_len=0, num_chains=0, overlay=0;
+  bucket_t *b;
+  for (idx=0; idx<ht->size; idx++) {
+    len = ht->image_start[idx+1] - ht->image_start[idx];
+    if (len > 0) {
+      num_chains++;
+    }
+    if (max_len < len) {
+      max_len = len;
+    }
+  }
+  /* overlay entries include tombstones for deleted image keys */
+  for (idx=0; idx<ht->overlay->size; idx++) {
+    for (b = ht->overlay->buckets[idx]; b; b = b->next) {
+      overlay++;
+    }
+  }
+  printf("Num entries = %lu\n", ht->count);
+  printf("Num image entries = %lu\n", (unsigned long)ht->image_start[ht->size]);
+  printf("Num overlay entries = %lu\n", overlay);
+  printf("Max image bucket length = %lu\n", max_len);
+  printf("Avg image bucket length = %0.2f\n",
+         num_chains ? (float)ht->image_start[ht->size] / num_chains : 0.0);
+}
+
+/* every stored hash in the table, in no particular order */
+static unsigned long *collect_hashes(hashtable_t *ht, unsigned long *n) {
+  unsigned long *hashes = malloc(sizeof(unsigned long) * (ht->count + 1));
+  unsigned long idx;
+  bucket_t *b;
+  *n = 0;
+  if (ht->backend != HT_CHAINED) {
+    for (idx=0; idx<open_slots(ht); idx++) {
+      if (ht->slots[idx].key) {
+        hashes[(*n)++] = ht->slots[idx].hash;
+      }
+    }
+    return hashes;
+  }
+  for (idx=0; idx<ht->size+ht->old_size; idx++) {
+    if (idx < ht->size) {
+      b = ht->buckets[idx];
+    } else if (idx - ht->size >= ht->migrate_pos) {
+      b = ht->old_buckets[idx - ht->size];
+    } else {
+      continue;
+    }
+    for (; b; b = b->next) {
+      hashes[(*n)++] = b->hash;
+    }
+  }
+  return hashes;
+}
+
+static int cmp_hash(const void *a, const void *b) {
+  unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* chi-squared statistic over its degrees of freedom for n hashes thrown
+   into 2^bits bins by the low or high bits; about 1.0 for a good hash */
+static double uniformity(unsigned long *hashes, unsigned long n, int bits, int high) {
+  unsigned long nbins = 1UL << bits, i, bin;
+  unsigned long *bins = calloc(sizeof(unsigned long), nbins);
+  double expect = (double)n / nbins, chi2 = 0;
+  for (i = 0; i < n; i++) {
+    bin = high ? hashes[i] >> (sizeof(unsigned long) * 8 - bits)
+               : hashes[i] & (nbins - 1);
+    bins[bin]++;
+  }
+  for (i = 0; i < nbins; i++) {
+    chi2 += (bins[i] - expect) * (bins[i] - expect) / expect;
+  }
+  free(bins);
+  return chi2 / (nbins - 1);
+}
+
+static void print_hash_quality(hashtable_t *ht) {
+  unsigned long n, i, collisions = 0;
+  unsigned long *hashes = collect_hashes(ht, &n);
+  int bits = 4;
+  /* about one key per bin */
+  while ((1UL << bits) < n && bits < 24) {
+    bits++;
+  }
+  qsort(hashes, n, sizeof(unsigned long), cmp_hash);
+  for (i = 1; i < n; i++) {
+    collisions += hashes[i] == hashes[i-1];
+  }
+  printf("Hash function = %s\n", hash_name);
+  printf("Full hash collisions = %lu\n", collisions);
+  if (n > 0) {
+    printf("Low %d bits chi2/df = %0.2f\n", bits, uniformity(hashes, n, bits, 0));
+    printf("High %d bits chi2/df = %0.2f\n", bits, uniformity(hashes, n, bits, 1));
+  }
+  free(hashes);
+}
+
+/* roughly what glibc's malloc takes for an n-byte request: a size word,
+   rounded up to 16 bytes, at least 32 */
+static unsigned long heap_cost(unsigned long n) {
+  n = (n + sizeof(size_t) + 15) & ~15UL;
+  return n < 32 ? 32 : n;
+}
+
+/* the bucket_t layout before short keys were stored inline */
+struct heap_key_bucket {
+  unsigned long hash;
+  char *key;
+  void *val;
+  bucket_t *next;
+  unsigned char flags;
+};
+
+/* arena tables take buckets from slabs and keys from 16-byte aligned
+   bump blocks, with no per-allocation header */
+static unsigned long key_cost(hashtable_t *ht, unsigned long n) {
+  return ht->arena ? (n + 15) & ~15UL : heap_cost(n);
+}
+
+/* bytes each entry's bucket and key take, as stored and as they'd be if
+   every key had its own allocation; values cost the same either way */
+static void print_key_storage(hashtable_t *ht) {
+  unsigned long idx, len, n=0, inlined=0, bytes=0, heap_bytes=0;
+  unsigned long node = ht->arena ? sizeof(bucket_t) : heap_cost(sizeof(bucket_t));
+  unsigned long old_node = ht->arena ? sizeof(struct heap_key_bucket)
+                                     : heap_cost(sizeof(struct heap_key_bucket));
+  bucket_t *b;
+  for (idx=0; idx<ht->size+ht->old_size; idx++) {
+    if (idx < ht->size) {
+      b = ht->buckets[idx];
+    } else if (idx - ht->size >= ht->migrate_pos) {
+      b = ht->old_buckets[idx - ht->size];
+    } else {
+      continue;
+    }
+    for (; b; b = b->next) {
+      n++;
+      len = bucket_keylen(b) + 1;
+      bytes += node;
+      heap_bytes += old_node + key_cost(ht, len);
+      if (b->flags & B_INLINE) {
+        inlined++;
+      } else {
+        bytes += key_cost(ht, len);
+      }
+    }
+  }
+  printf("Inline keys = %lu of %lu\n", inlined, n);
+  printf("Bytes per entry = %0.1f (%0.1f with every key on the heap)\n",
+         n ? (double)bytes / n : 0.0, n ? (double)heap_bytes / n : 0.0);
+}
+
+/* what -P got the array lookups start in: huge pages only come for one
+   that fills a page, and only if the system hands them out */
+static void print_page_kind(hashtable_t *ht) {
+  static const char *kinds[] = { "none", "transparent (madvise)", "hugetlbfs" };
+  const void *arr = ht->backend == HT_CHAINED ? (const void *)ht->buckets
+    : ht->backend == HT_COMPACT ? (const void *)ht->index : (const void *)ht->slots;
+  printf("Huge pages = %s\n", kinds[ht_array_pages(arr)]);
+}
+
+/* the table's running counters; unlike the rest, nothing is walked */
+static void print_op_stats(hashtable_t *ht) {
+  ht_stats_t st;
+  unsigned long lookups = 0;
+  int i;
+  ht_stats(ht, &st);
+  for (i = 0; i < HT_PROBE_HIST; i++) {
+    lookups += st.probe_hist[i];
+  }
+  printf("Gets = %lu (%lu hits, %lu misses)\n", st.gets, st.hits, st.misses);
+  printf("Puts = %lu (%lu updates)\n", st.puts, st.updates);
+  printf("Deletes = %lu\n", st.deletes);
+  printf("Rehashes = %lu\n", st.rehashes);
+  if (ht->cache) {
+    printf("Evictions = %lu\n", st.evictions);
+  }
+  if (ht->bloom) {
+    printf("Bloom false positive rate = %0.2f%% (%lu of %lu misses got past the filter)\n",
+           st.bloom_false_pos + st.bloom_rejects
+             ? 100.0 * st.bloom_false_pos / (st.bloom_false_pos + st.bloom_rejects) : 0.0,
+           st.bloom_false_pos, st.bloom_false_pos + st.bloom_rejects);
+  }
+  if (ht->huge_pages) {
+    print_page_kind(ht);
+  }
+  printf("Probes per lookup = %0.2f\n", lookups ? (double)st.probes / lookups : 0.0);
+  printf("Probe lengths =");
+  for (i = 0; i < HT_PROBE_HIST; i++) {
+    if (st.probe_hist[i]) {
+      printf(" %d%s:%lu", i, i == HT_PROBE_HIST - 1 ? "+" : "", st.probe_hist[i]);
+    }
+  }
+  printf("\n");
+}
+
+void print_ht_stats(hashtable_t *ht) {
+  if (ht->backend == HT_MAPPED) {
+    print_mapped_stats(ht);
+  } else if (ht->backend != HT_CHAINED) {
+    print_open_stats(ht);
+  } else {
+    print_chain_stats(ht);
+  }
+  if (!verbose) {
+    return;
+  }
+  print_op_stats(ht);
+  /* a mapped image's hashes were judged when it was saved */
+  if (ht->backend != HT_MAPPED) {
+    print_hash_quality(ht);
+  }
+  if (ht->backend == HT_CHAINED) {
+    print_key_storage(ht);
+  }
+}
+
+/* the table a trace starts from: the -M image, or a new empty table */
+static hashtable_t *start_table(unsigned long size) {
+  hashtable_t *ht;
+  if (!map_path) {
+    opts.size = size;
+    return make_hashtable_opts(&opts);
+  }
+  /* the image sets its own size */
+  if ((ht = ht_open_mapped(map_path)) == NULL) {
+    printf("Error mapping image %s\n", map_path);
+    exit(1);
+  }
+  return ht;
+}
+
+static void finish_table(hashtable_t *ht) {
+  if (save_path && ht_save(ht, save_path) != 0) {
+    printf("Error saving image %s\n", save_path);
+    exit(1);
+  }
+  free_hashtable(ht);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* one pre-parsed directive, with no output; 'i' does nothing. hashed
+   says op->hash came from the table's own hash function, as a compiled
+   trace's do when it was compiled with the same -H, so the key needn't be
+   hashed again. */
+static void replay_op(hashtable_t *ht, trace_op_t *op, int hashed) {
+  char *key;
+  switch (op->type) {
+  case 'p':
+    if (opts.arena) {
+      ht_put_copy(ht, op->key, op->val, strlen(op->val) + 1);
+    } else if (hashed) {
+      key = malloc(op->keylen + 1);
+      memcpy(key, op->key, op->keylen + 1);
+      ht_put_hashed(ht, key, op->keylen, strdup(op->val), op->hash);
+    } else {
+      ht_put(ht, strdup(op->key), strdup(op->val));
+    }
+    break;
+  case 'g':
+    if (hashed) {
+      ht_get_hashed(ht, op->key, op->keylen, op->hash);
+    } else {
+      ht_get(ht, op->key);
+    }
+    break;
+  case 'd':
+    if (hashed) {
+      ht_del_hashed(ht, op->key, op->keylen, op->hash);
+    } else {
+      ht_del(ht, op->key);
+    }
+    break;
+  case 'r':
+    ht_rehash(ht, op->n);
+    break;
+  case 'R':
+    ht_rehash_incremental(ht, op->n);
+    break;
+  }
+}
+
+/* Replays a pre-parsed trace with no output and reports throughput. Ops
+   of a kind tend to come in long runs, so the clock is only read when the
+   directive changes; per-op timer calls would cost as much as the ops.
+   Insert times include copying the key and value, as eval_tracefile's do.
+   A compiled trace is replayed straight from its mapping. */
+void bench_tracefile(char *filename) {
+  static const char kinds[] = "pgdrRi";
+  double secs[128] = { 0 }, start, t, t2, total;
+  unsigned long count[128] = { 0 }, i;
+  struct rusage ru;
+  long base_rss;
+  trace_op_t op;
+  trace_t *trace;
+  hashtable_t *ht;
+  char cur;
+  int k, hashed;
+
+  if ((trace = load_trace(filename)) == NULL) {
+    exit(1);
+  }
+  /* the loaded trace is a baseline; the table's own growth is on top */
+  getrusage(RUSAGE_SELF, &ru);
+  base_rss = ru.ru_maxrss;
+  ht = start_table(trace->size);
+  hashed = trace->hashfn == ht->hashfn;
+  cur = trace->nops ? trace_op(trace, 0).type : 0;
+  start = t = now();
+  for (i = 0; i < trace->nops; i++) {
+    op = trace_op(trace, i);
+    if (op.type != cur) {
+      t2 = now();
+      secs[(unsigned char)cur] += t2 - t;
+      t = t2;
+      cur = op.type;
+    }
+    count[(unsigned char)op.type]++;
+    replay_op(ht, &op, hashed);
+  }
+  secs[(unsigned char)cur] += now() - t;
+  total = now() - start;
+
+  printf("%lu ops in %0.3f s, %0.2f Mops/s\n", trace->nops, total,
+         total > 0 ? trace->nops / total / 1e6 : 0.0);
+  for (k = 0; kinds[k]; k++) {
+    if (count[(unsigned char)kinds[k]]) {
+      printf("  %c %10lu ops %10.1f ns/op\n", kinds[k], count[(unsigned char)kinds[k]],
+             secs[(unsigned char)kinds[k]] / count[(unsigned char)kinds[k]] * 1e9);
+    }
+  }
+  finish_table(ht);
+  free_trace(trace);
+  getrusage(RUSAGE_SELF, &ru);
+  /* ru_maxrss is in kilobytes on Linux */
+  printf("Peak RSS = %ld KB, %ld KB over the loaded trace\n", ru.ru_maxrss,
+         ru.ru_maxrss - base_rss);
+}
+
+/* one shard's share of a trace for -j: the ops on keys it owns, and
+   every resize, scaled to its share of the table */
+typedef struct {
+  trace_op_t *ops;
+  unsigned long nops;
+  int hashed;               /* see replay_op */
+  unsigned long entries;
+  double secs;
+} shard_part_t;
+
+/* runs on the shard's own thread */
+static void replay_part(hashtable_t *ht, void *arg) {
+  shard_part_t *p = arg;
+  unsigned long i;
+  double start = now();
+  for (i = 0; i < p->nops; i++) {
+    replay_op(ht, &p->ops[i], p->hashed);
+  }
+  p->secs = now() - start;
+  p->entries = ht->count;
+}
+
+/* Splits a trace by owning shard up front, then has every shard replay
+   its part at once. Reports the overall rate, each shard's share, and
+   how far the busiest shard is above the mean, since the slowest shard
+   sets the pace. */
+void bench_sharded(char *filename) {
+  double start, total, max_ops = 0, max_entries = 0, entries = 0;
+  shard_part_t *parts = calloc(jobs, sizeof(shard_part_t));
+  unsigned int *owner;
+  shashtable_t *st;
+  trace_op_t op;
+  trace_t *trace;
+  unsigned long i;
+  unsigned int j;
+
+  if ((trace = load_trace(filename)) == NULL) {
+    exit(1);
+  }
+  opts.size = trace->size;
+  st = make_shashtable(jobs, &opts);
+  owner = malloc(sizeof(unsigned int) * (trace->nops + 1));
+  for (i = 0; i < trace->nops; i++) {
+    op = trace_op(trace, i);
+    if (op.key) {
+      owner[i] = sht_shard(st, op.key, op.keylen);
+      parts[owner[i]].nops++;
+    } else if (op.type == 'r' || op.type == 'R') {
+      for (j = 0; j < jobs; j++) {
+        parts[j].nops++;
+      }
+    }
+  }
+  for (j = 0; j < jobs; j++) {
+    parts[j].ops = malloc(sizeof(trace_op_t) * (parts[j].nops + 1));
+    parts[j].nops = 0;
+    parts[j].hashed = trace->hashfn == sht_table(st, j)->hashfn;
+  }
+  for (i = 0; i < trace->nops; i++) {
+    op = trace_op(trace, i);
+    if (op.key) {
+      parts[owner[i]].ops[parts[owner[i]].nops++] = op;
+    } else if (op.type == 'r' || op.type == 'R') {
+      for (j = 0; j < jobs; j++) {
+        parts[j].ops[parts[j].nops] = op;
+        parts[j].ops[parts[j].nops++].n = op.n / jobs ? op.n / jobs : 1;
+      }
+    }
+  }
+  free(owner);
+
+  start = now();
+  for (j = 0; j < jobs; j++) {
+    sht_exec(st, j, replay_part, &parts[j]);
+  }
+  sht_sync(st);
+  total = now() - start;
+
+  printf("%lu ops in %0.3f s, %0.2f Mops/s on %u shards\n", trace->nops, total,
+         total > 0 ? trace->nops / total / 1e6 : 0.0, jobs);
+  for (j = 0; j < jobs; j++) {
+    printf("  shard %2u %10lu ops %10lu entries %8.3f s\n", j, parts[j].nops,
+           parts[j].entries, parts[j].secs);
+    if (max_ops < parts[j].nops) {
+      max_ops = parts[j].nops;
+    }
+    if (max_entries < parts[j].entries) {
+      max_entries = parts[j].entries;
+    }
+    entries += parts[j].entries;
+  }
+  printf("Num entries = %0.0f\n", entries);
+  printf("Load imbalance (max/mean) = %0.2f ops, %0.2f entries\n",
+         trace->nops ? max_ops * jobs / trace->nops : 0.0,
+         entries > 0 ? max_entries * jobs / entries : 0.0);
+  free_shashtable(st);
+  for (j = 0; j < jobs; j++) {
+    free(parts[j].ops);
+  }
+  free(parts);
+  free_trace(trace);
 }
 
 void eval_tracefile(char *filename) {
   FILE *infile;
   int ht_size;
-  char buf[80], *key, *val;
+  char buf[80], vbuf[80], *key, *val;
   hashtable_t *ht;
 
   if ((infile = fopen(filename, "r")) == NULL) {
@@ -45,13 +543,30 @@ void eval_tracefile(char *filename) {
     exit(1);
   }
 
+  /* compiled traces have no text to narrate from */
+  if (fread(buf, 1, 8, infile) == 8 && memcmp(buf, TRACE_MAGIC, 8) == 0) {
+    printf("%s is a compiled trace; replay it with -q or -j\n", filename);
+    exit(1);
+  }
+  rewind(infile);
   fscanf(infile, "%d", &ht_size);
-  printf("Creating hashtable of size %d\n", ht_size);
-  ht = make_hashtable(ht_size);
+  if (map_path) {
+    printf("Mapping hashtable image %s\n", map_path);
+  } else {
+    printf("Creating hashtable of size %d\n", ht_size);
+  }
+  ht = start_table(ht_size);
 
   while (fscanf(infile, "%s", buf) != EOF) {
     switch(buf[0]) {
     case 'p':
+      if (opts.arena) {
+        /* let the table copy straight out of our buffers */
+        fscanf(infile, "%s %s", buf, vbuf);
+        printf("Inserting %s => %s\n", buf, vbuf);
+        ht_put_copy(ht, buf, vbuf, strlen(vbuf) + 1);
+        break;
+      }
       fscanf(infile, "%s", buf);
       key = strdup(buf);
       fscanf(infile, "%s", buf);
@@ -78,6 +593,11 @@ void eval_tracefile(char *filename) {
       printf("Rehashing to %d buckets\n", ht_size);
       ht_rehash(ht, ht_size);
       break;
+    case 'R':
+      fscanf(infile, "%d", &ht_size);
+      printf("Incrementally rehashing to %d buckets\n", ht_size);
+      ht_rehash_incremental(ht, ht_size);
+      break;
     case 'i':
       printf("Printing hashtable info\n");
       print_ht_stats(ht);
@@ -87,16 +607,123 @@ void eval_tracefile(char *filename) {
       exit(1);
     }
   }
-  free_hashtable(ht);
+  finish_table(ht);
   fclose(infile);
 }
 
+static void usage(char *prog) {
+  printf("Usage: %s [-b chained|robinhood|swiss|compact] [-g MAX_LOAD] [-s MIN_LOAD] [-I] [-A] [-c CAPACITY] [-e lru|clock] [-B] [-P] [-H djb2|wy] [-v] [-S FILE] [-M FILE] [-q] [-j SHARDS] TRACEFILE_NAME\n", prog);
+  printf("  -b  storage backend (default chained)\n");
+  printf("  -g  grow the table when entries/size exceeds MAX_LOAD\n");
+  printf("  -s  shrink the table when entries/size drops below MIN_LOAD\n");
+  printf("  -I  do automatic resizes incrementally\n");
+  printf("  -A  arena mode: slab buckets, keys/values copied into the table\n");
+  printf("  -c  cache mode: evict once the table holds more than CAPACITY\n"
+         "      entries (chained, not with -A)\n");
+  printf("  -e  which entry a full cache evicts (default lru)\n");
+  printf("  -B  put a Bloom filter in front of the table for misses\n");
+  printf("  -P  back the table's arrays with huge pages where available\n");
+  printf("  -H  hash function (default djb2)\n");
+  printf("  -v  add operation counters, hash quality and key storage to the\n"
+         "      info output\n");
+  printf("  -S  save the table to FILE once the trace is done\n");
+  printf("  -M  replay the trace on the image in FILE (from -S) rather than an\n"
+         "      empty table; the tracefile's size is ignored\n");
+  printf("  -q  quiet: replay without output and report ops/sec, ns/op per\n"
+         "      directive, and peak memory. Takes traces compiled by htcompile\n"
+         "      as well, as does -j\n");
+  printf("  -j  split the table and the trace by key into SHARDS parts, each\n"
+         "      replayed quietly by its own thread; reports throughput and how\n"
+         "      evenly the work spread. Not with -S or -M\n");
+  exit(0);
+}
+
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    printf("Usage: %s TRACEFILE_NAME\n", argv[0]);
-    exit(0);
+  int c;
+  while ((c = getopt(argc, argv, "b:g:s:IAc:e:BPH:vS:M:qj:")) != -1) {
+    switch (c) {
+    case 'b':
+      if (strcmp(optarg, "chained") == 0) {
+        opts.backend = HT_CHAINED;
+      } else if (strcmp(optarg, "robinhood") == 0) {
+        opts.backend = HT_ROBINHOOD;
+      } else if (strcmp(optarg, "swiss") == 0) {
+        opts.backend = HT_SWISS;
+      } else if (strcmp(optarg, "compact") == 0) {
+        opts.backend = HT_COMPACT;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'g':
+      opts.max_load = atof(optarg);
+      break;
+    case 's':
+      opts.min_load = atof(optarg);
+      break;
+    case 'I':
+      opts.incremental = 1;
+      break;
+    case 'A':
+      opts.arena = 1;
+      break;
+    case 'c':
+      opts.capacity = strtoul(optarg, NULL, 10);
+      break;
+    case 'e':
+      if (strcmp(optarg, "lru") == 0) {
+        opts.evict = HT_EVICT_LRU;
+      } else if (strcmp(optarg, "clock") == 0) {
+        opts.evict = HT_EVICT_CLOCK;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'B':
+      opts.bloom = 1;
+      break;
+    case 'P':
+      opts.huge_pages = 1;
+      break;
+    case 'H':
+      if (strcmp(optarg, "djb2") == 0) {
+        opts.hash = ht_hash_djb2;
+      } else if (strcmp(optarg, "wy") == 0) {
+        opts.hash = ht_hash_wy;
+      } else {
+        usage(argv[0]);
+      }
+      hash_name = optarg;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'S':
+      save_path = optarg;
+      break;
+    case 'M':
+      map_path = optarg;
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    case 'j':
+      jobs = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind >= argc || (jobs && (save_path || map_path))) {
+    usage(argv[0]);
+  }
+  if (jobs) {
+    bench_sharded(argv[optind]);
+  } else if (quiet) {
+    bench_tracefile(argv[optind]);
+  } else {
+    eval_tracefile(argv[optind]);
   }
-  eval_tracefile(argv[1]);
   return 0;
 }
 
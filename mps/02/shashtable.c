@@ -0,0 +1,251 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable.h"
+#include "shashtable.h"
+
+#define CACHELINE 64
+
+/* Each shard has a mailbox: a FIFO list of messages under a mutex, which
+   its thread empties in one go and then works through without the lock.
+   Replies (to gets and syncs) are written into the sender's message,
+   which lives on the sender's stack, and announced on the shard's done
+   condition. */
+
+typedef enum { MSG_PUT, MSG_GET, MSG_DEL, MSG_EXEC, MSG_SYNC, MSG_STOP } msg_type_t;
+
+typedef struct sht_msg sht_msg_t;
+struct sht_msg {
+  sht_msg_t *next;
+  msg_type_t type;
+  char *key;
+  size_t keylen;
+  void *val;                      /* put: the value; get: the reply */
+  void (*fn)(hashtable_t *, void *);
+  int done;                       /* get, sync: set once handled */
+  char keybuf[];                  /* del: its own copy of the key */
+};
+
+typedef struct {
+  hashtable_t *ht;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;            /* mail has arrived */
+  pthread_cond_t done;            /* a get or sync was answered */
+  sht_msg_t *head, *tail;
+} __attribute__((aligned(CACHELINE))) sht_shard_t;
+
+struct shashtable {
+  sht_shard_t *shards;
+  unsigned int nshards;
+  ht_hash_fn hashfn;
+};
+
+static void post(sht_shard_t *s, sht_msg_t *m) {
+  m->next = NULL;
+  pthread_mutex_lock(&s->lock);
+  if (s->tail) {
+    s->tail->next = m;
+  } else {
+    s->head = m;
+    pthread_cond_signal(&s->wake);
+  }
+  s->tail = m;
+  pthread_mutex_unlock(&s->lock);
+}
+
+/* posts m, which the shard answers in place, and waits for the answer */
+static void call(sht_shard_t *s, sht_msg_t *m) {
+  m->done = 0;
+  post(s, m);
+  pthread_mutex_lock(&s->lock);
+  while (!m->done) {
+    pthread_cond_wait(&s->done, &s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void answer(sht_shard_t *s, sht_msg_t *m) {
+  pthread_mutex_lock(&s->lock);
+  m->done = 1;
+  pthread_cond_broadcast(&s->done);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void *shard_main(void *arg) {
+  sht_shard_t *s = arg;
+  sht_msg_t *m, *next;
+  int stop = 0;
+  while (!stop) {
+    pthread_mutex_lock(&s->lock);
+    while (!s->head) {
+      pthread_cond_wait(&s->wake, &s->lock);
+    }
+    m = s->head;
+    s->head = s->tail = NULL;
+    pthread_mutex_unlock(&s->lock);
+    for (; m; m = next) {
+      next = m->next;
+      switch (m->type) {
+      case MSG_PUT:
+        ht_put_n(s->ht, m->key, m->keylen, m->val);
+        free(m);
+        break;
+      case MSG_GET:
+        m->val = ht_get_n(s->ht, m->key, m->keylen);
+        answer(s, m);
+        break;
+      case MSG_DEL:
+        ht_del_n(s->ht, m->key, m->keylen);
+        free(m);
+        break;
+      case MSG_EXEC:
+        m->fn(s->ht, m->val);
+        free(m);
+        break;
+      case MSG_SYNC:
+        answer(s, m);
+        break;
+      case MSG_STOP:
+        /* it's last in the queue; nothing may be sent after it */
+        stop = 1;
+        answer(s, m);
+        break;
+      }
+    }
+  }
+  return NULL;
+}
+
+shashtable_t *make_shashtable(unsigned int nshards, const ht_opts_t *opts) {
+  shashtable_t *st = malloc(sizeof(shashtable_t));
+  ht_opts_t shard_opts = *opts;
+  sht_shard_t *s;
+  unsigned int i;
+  if (nshards == 0) {
+    nshards = 1;
+  }
+  if (posix_memalign((void **)&st->shards, CACHELINE, sizeof(sht_shard_t) * nshards) != 0) {
+    free(st);
+    return NULL;
+  }
+  st->nshards = nshards;
+  st->hashfn = opts->hash ? opts->hash : ht_hash_djb2;
+  /* each shard sees about 1/nshards of the keys */
+  shard_opts.size = (opts->size + nshards - 1) / nshards;
+  if (shard_opts.size == 0) {
+    shard_opts.size = 1;
+  }
+  for (i = 0; i < nshards; i++) {
+    s = &st->shards[i];
+    memset(s, 0, sizeof(sht_shard_t));
+    s->ht = make_hashtable_opts(&shard_opts);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->wake, NULL);
+    pthread_cond_init(&s->done, NULL);
+    pthread_create(&s->thread, NULL, shard_main, s);
+  }
+  return st;
+}
+
+/* The shard tables index by the hash's low bits, so the shard comes from
+   the high ones. djb2 leaves those empty for short keys; multiplying by
+   2^64 / phi (Fibonacci hashing) folds every bit of the hash into the top
+   32, which then scale down to [0, nshards). */
+unsigned int sht_shard(shashtable_t *st, const char *key, size_t keylen) {
+  unsigned long h = st->hashfn(key, keylen) * 0x9E3779B97F4A7C15UL;
+  return ((h >> 32) * st->nshards) >> 32;
+}
+
+unsigned int sht_nshards(shashtable_t *st) {
+  return st->nshards;
+}
+
+void sht_put(shashtable_t *st, char *key, void *val) {
+  sht_msg_t *m = malloc(sizeof(sht_msg_t));
+  m->type = MSG_PUT;
+  m->key = key;
+  m->keylen = strlen(key);
+  m->val = val;
+  post(&st->shards[sht_shard(st, key, m->keylen)], m);
+}
+
+void *sht_get(shashtable_t *st, char *key) {
+  sht_msg_t m;
+  m.type = MSG_GET;
+  m.key = key;
+  m.keylen = strlen(key);
+  call(&st->shards[sht_shard(st, key, m.keylen)], &m);
+  return m.val;
+}
+
+void sht_del(shashtable_t *st, char *key) {
+  size_t len = strlen(key);
+  /* the caller may free key as soon as we return */
+  sht_msg_t *m = malloc(sizeof(sht_msg_t) + len + 1);
+  m->type = MSG_DEL;
+  memcpy(m->keybuf, key, len + 1);
+  m->key = m->keybuf;
+  m->keylen = len;
+  post(&st->shards[sht_shard(st, key, len)], m);
+}
+
+void sht_exec(shashtable_t *st, unsigned int shard,
+              void (*fn)(hashtable_t *, void *), void *arg) {
+  sht_msg_t *m = malloc(sizeof(sht_msg_t));
+  m->type = MSG_EXEC;
+  m->fn = fn;
+  m->val = arg;
+  post(&st->shards[shard], m);
+}
+
+void sht_sync(shashtable_t *st) {
+  sht_msg_t *m = calloc(st->nshards, sizeof(sht_msg_t));
+  unsigned int i;
+  /* post them all before waiting, so the shards drain side by side */
+  for (i = 0; i < st->nshards; i++) {
+    m[i].type = MSG_SYNC;
+    m[i].done = 0;
+    post(&st->shards[i], &m[i]);
+  }
+  for (i = 0; i < st->nshards; i++) {
+    pthread_mutex_lock(&st->shards[i].lock);
+    while (!m[i].done) {
+      pthread_cond_wait(&st->shards[i].done, &st->shards[i].lock);
+    }
+    pthread_mutex_unlock(&st->shards[i].lock);
+  }
+  free(m);
+}
+
+hashtable_t *sht_table(shashtable_t *st, unsigned int shard) {
+  return st->shards[shard].ht;
+}
+
+unsigned long sht_count(shashtable_t *st) {
+  unsigned long n = 0;
+  unsigned int i;
+  sht_sync(st);
+  for (i = 0; i < st->nshards; i++) {
+    n += st->shards[i].ht->count;
+  }
+  return n;
+}
+
+void free_shashtable(shashtable_t *st) {
+  sht_shard_t *s;
+  sht_msg_t m;
+  unsigned int i;
+  for (i = 0; i < st->nshards; i++) {
+    s = &st->shards[i];
+    m.type = MSG_STOP;
+    call(s, &m);
+    pthread_join(s->thread, NULL);
+    free_hashtable(s->ht);
+    pthread_cond_destroy(&s->done);
+    pthread_cond_destroy(&s->wake);
+    pthread_mutex_destroy(&s->lock);
+  }
+  free(st->shards);
+  free(st);
+}
@@ -0,0 +1,46 @@
+#ifndef SHASHTABLE_T
+#define SHASHTABLE_T
+
+#include <stddef.h>
+#include "hashtable.h"
+
+/* Sharded variant of hashtable_t: keys are split by hash across N plain
+   hashtable_t shards, and each shard is owned by one worker thread that
+   is the only one ever to touch it. Nothing is shared and nothing locked
+   per entry. Other threads reach a shard by message: sht_put and sht_del
+   queue the operation on the owner's mailbox and return, and sht_get
+   waits for the owner's answer. Messages one thread sends to a shard are
+   handled in the order sent.
+
+   sht_exec runs a function on a shard's own thread against its table,
+   which is how bulk work (a replay, a scan) is done without a message
+   per key. Don't call sht_get or sht_sync from inside one; a shard
+   waiting on another that is waiting on it would never wake. */
+
+typedef struct shashtable shashtable_t;
+
+/* opts is used for every shard, with the size split between them */
+shashtable_t *make_shashtable(unsigned int nshards, const ht_opts_t *opts);
+/* the shard that owns key; the same for every call, so callers can
+   partition work by it */
+unsigned int sht_shard(shashtable_t *st, const char *key, size_t keylen);
+unsigned int sht_nshards(shashtable_t *st);
+/* takes ownership of key and val, as ht_put does */
+void  sht_put(shashtable_t *st, char *key, void *val);
+/* the value may be freed by a later put or del as soon as this returns */
+void *sht_get(shashtable_t *st, char *key);
+void  sht_del(shashtable_t *st, char *key);
+/* queues fn(table, arg) on shard's thread */
+void  sht_exec(shashtable_t *st, unsigned int shard,
+               void (*fn)(hashtable_t *, void *), void *arg);
+/* waits until every message sent so far, by any thread, has been handled */
+void  sht_sync(shashtable_t *st);
+/* a shard's table; only for its own thread, or between sht_sync and the
+   next message */
+hashtable_t *sht_table(shashtable_t *st, unsigned int shard);
+/* entries over all shards; syncs first */
+unsigned long sht_count(shashtable_t *st);
+/* handles anything still queued, then stops the threads */
+void  free_shashtable(shashtable_t *st);
+
+#endif
@@ -0,0 +1,192 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "trace.h"
+
+/* The tracefile is mapped privately and writably, and every token is
+   NUL-terminated where it sits, so keys and values point into the mapping
+   and loading copies nothing. Writes only dirty our own copy of a page;
+   the file never changes. A compiled trace is never written to; it's
+   checked once and then read in place. */
+
+/* the next whitespace-separated token, NUL-terminated, or NULL at the end */
+static char *next_token(trace_t *t, size_t *pos) {
+  char *start;
+  size_t len;
+  while (*pos < t->len && isspace((unsigned char)t->buf[*pos])) {
+    (*pos)++;
+  }
+  if (*pos == t->len) {
+    return NULL;
+  }
+  start = t->buf + *pos;
+  while (*pos < t->len && !isspace((unsigned char)t->buf[*pos])) {
+    (*pos)++;
+  }
+  if (*pos < t->len) {
+    t->buf[(*pos)++] = '\0';
+    return start;
+  }
+  /* the last token runs to the end of the file, with nowhere in the
+     mapping to put its NUL */
+  len = t->buf + t->len - start;
+  t->tail = malloc(len + 1);
+  memcpy(t->tail, start, len);
+  t->tail[len] = '\0';
+  return t->tail;
+}
+
+/* Checks every record and string entry, so trace_op can trust them. The
+   header's counts are checked against the file's length before anything
+   is sized by them. */
+static int load_compiled(trace_t *t) {
+  const trace_file_t *hdr = (const trace_file_t *)t->buf;
+  const trace_rec_t *r;
+  const trace_str_t *s;
+  size_t room = t->len - sizeof(trace_file_t);
+  unsigned long i;
+  if (!ht_hash_by_id(hdr->hash) || hdr->nops > room / sizeof(trace_rec_t)) {
+    return -1;
+  }
+  if (TRACE_RECS_BYTES(hdr->nops) > room) {
+    return -1;
+  }
+  room -= TRACE_RECS_BYTES(hdr->nops);
+  if (hdr->nstrs > room / sizeof(trace_str_t)
+      || hdr->pool_len != room - hdr->nstrs * sizeof(trace_str_t)) {
+    return -1;
+  }
+  t->size = hdr->size;
+  t->nops = hdr->nops;
+  t->recs = (const trace_rec_t *)(hdr + 1);
+  t->strs = (const trace_str_t *)((const char *)t->recs + TRACE_RECS_BYTES(hdr->nops));
+  t->pool = (char *)(t->strs + hdr->nstrs);
+  t->hashfn = ht_hash_by_id(hdr->hash);
+  for (i = 0; i < hdr->nstrs; i++) {
+    s = &t->strs[i];
+    if (s->off >= hdr->pool_len || s->len >= hdr->pool_len - s->off
+        || t->pool[s->off + s->len] != '\0') {
+      return -1;
+    }
+  }
+  for (i = 0; i < hdr->nops; i++) {
+    r = &t->recs[i];
+    switch (r->type) {
+    case 'p':
+      if (r->arg >= hdr->nstrs) {
+        return -1;
+      }
+      /* fall through */
+    case 'g':
+    case 'd':
+      if (r->key >= hdr->nstrs) {
+        return -1;
+      }
+      break;
+    case 'r':
+    case 'R':
+    case 'i':
+      break;
+    default:
+      return -1;
+    }
+  }
+  return 0;
+}
+
+trace_t *load_trace(char *filename) {
+  struct stat st;
+  unsigned long cap = 1024;
+  size_t pos = 0;
+  char *tok, *arg;
+  trace_t *t;
+  trace_op_t *op;
+  int fd;
+
+  if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    printf("Error opening tracefile %s\n", filename);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return NULL;
+  }
+  t = calloc(1, sizeof(trace_t));
+  t->len = st.st_size;
+  if (t->len > 0) {
+    t->buf = mmap(NULL, t->len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (t->buf == MAP_FAILED) {
+    printf("Error opening tracefile %s\n", filename);
+    free(t);
+    return NULL;
+  }
+  if (t->len >= sizeof(trace_file_t) && memcmp(t->buf, TRACE_MAGIC, 8) == 0) {
+    if (load_compiled(t) != 0) {
+      printf("Corrupt compiled tracefile %s\n", filename);
+      free_trace(t);
+      return NULL;
+    }
+    return t;
+  }
+  t->ops = malloc(sizeof(trace_op_t) * cap);
+  if ((tok = next_token(t, &pos))) {
+    t->size = strtoul(tok, NULL, 10);
+  }
+
+  while ((tok = next_token(t, &pos))) {
+    if (t->nops == cap) {
+      cap *= 2;
+      t->ops = realloc(t->ops, sizeof(trace_op_t) * cap);
+    }
+    op = &t->ops[t->nops++];
+    memset(op, 0, sizeof(trace_op_t));
+    op->type = tok[0];
+    switch(tok[0]) {
+    case 'p':
+      op->key = next_token(t, &pos);
+      op->val = next_token(t, &pos);
+      break;
+    case 'g':
+    case 'd':
+      op->key = next_token(t, &pos);
+      break;
+    case 'r':
+    case 'R':
+      if ((arg = next_token(t, &pos))) {
+        op->n = strtoul(arg, NULL, 10);
+      }
+      break;
+    case 'i':
+      break;
+    default:
+      printf("Bad tracefile directive (%c)", tok[0]);
+      free_trace(t);
+      return NULL;
+    }
+    /* a directive cut off by the end of the file */
+    if ((op->type == 'p' && !op->val) || ((op->type == 'g' || op->type == 'd') && !op->key)) {
+      printf("Truncated tracefile %s\n", filename);
+      free_trace(t);
+      return NULL;
+    }
+    if (op->key) {
+      op->keylen = strlen(op->key);
+    }
+  }
+  return t;
+}
+
+void free_trace(trace_t *t) {
+  if (t->buf) {
+    munmap(t->buf, t->len);
+  }
+  free(t->tail);
+  free(t->ops);
+  free(t);
+}
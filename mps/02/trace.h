@@ -0,0 +1,100 @@
+#ifndef TRACE_T
+#define TRACE_T
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hashtable.h"
+
+/* A tracefile parsed up front into an array of operations, for drivers
+   that want to replay it without paying for parsing along the way. The
+   file is mmapped and keys and values point into the mapping, so they
+   stay valid until free_trace.
+
+   load_trace also takes traces compiled by htcompile, which need no
+   parsing at all. Those are replayed straight from the mapping: read ops
+   with trace_op, which works for either kind. */
+
+typedef struct trace_op {
+  char type;          /* directive letter: p, g, d, r, R or i */
+  char *key;          /* p, g, d */
+  char *val;          /* p */
+  unsigned long n;    /* r, R: new size */
+  size_t keylen;
+  unsigned long hash; /* compiled traces: key's hash under trace_t.hashfn */
+} trace_op_t;
+
+/* A compiled trace is a trace_file_t header, nops trace_rec_t records
+   padded to a multiple of 8 bytes, nstrs trace_str_t entries and pool_len
+   bytes of NUL-terminated strings, all little-endian as written. Every
+   distinct key and value is stored once, and records name them by index
+   into the entries. */
+#define TRACE_MAGIC "HTTRACE1"
+#define TRACE_RECS_BYTES(nops) (((nops) * sizeof(trace_rec_t) + 7) & ~(size_t)7)
+
+typedef struct trace_file {
+  char magic[8];
+  uint64_t size;      /* initial table size */
+  uint64_t nops;
+  uint64_t nstrs;
+  uint64_t pool_len;
+  uint64_t hash;      /* ht_hash_id of what made trace_str_t.hash */
+} trace_file_t;
+
+typedef struct trace_rec {
+  uint32_t type;
+  uint32_t key;       /* p, g, d: entry index */
+  uint32_t arg;       /* p: the value's entry index; r, R: new size */
+} trace_rec_t;
+
+typedef struct trace_str {
+  uint64_t hash;
+  uint64_t off;       /* into the pool */
+  uint64_t len;
+} trace_str_t;
+
+typedef struct trace {
+  unsigned long size; /* initial table size from the first line */
+  unsigned long nops;
+  trace_op_t *ops;    /* text traces */
+  char *buf;          /* the mapped file */
+  size_t len;
+  char *tail;         /* copy of a last token that ran up to EOF */
+  /* compiled traces */
+  const trace_rec_t *recs;
+  const trace_str_t *strs;
+  char *pool;
+  ht_hash_fn hashfn;  /* NULL for text traces, which carry no hashes */
+} trace_t;
+
+/* prints a message and returns NULL if the file can't be read or has a
+   bad directive */
+trace_t *load_trace(char *filename);
+void free_trace(trace_t *t);
+
+static inline trace_op_t trace_op(const trace_t *t, unsigned long i) {
+  trace_op_t op = { 0 };
+  const trace_rec_t *r;
+  if (t->ops) {
+    return t->ops[i];
+  }
+  r = &t->recs[i];
+  op.type = r->type;
+  switch (op.type) {
+  case 'p':
+    op.val = t->pool + t->strs[r->arg].off;
+    /* fall through */
+  case 'g':
+  case 'd':
+    op.key = t->pool + t->strs[r->key].off;
+    op.keylen = t->strs[r->key].len;
+    op.hash = t->strs[r->key].hash;
+    break;
+  case 'r':
+  case 'R':
+    op.n = r->arg;
+    break;
+  }
+  return op;
+}
+
+#endif
@@ -6,6 +6,9 @@
 
 #include "mm.h"
 #include "memlib.h"
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
 /* for the free list ranges */
 #include <limits.h>
 
@@ -237,7 +240,21 @@ void dbg_p_all_lists(void){
   }
 }
 
-int mm_init(void){
+/* bytes of the heap in allocated blocks, tags and all */
+static size_t heap_allocated(void){
+  size_t total = 0;
+  /* skip the prologue and free lists */
+  void *block = prologue + 2*SIZE_T_SIZE;
+  while (block != epilogue){
+    if (allocated(block)){
+      total += block_size(block);
+    }
+    block = next_block(block);
+  }
+  return total;
+}
+
+static int heap_init(void){
   int i;
   size_t prologue_size = 2*SIZE_T_SIZE;
   size_t epilogue_hdr_size = SIZE_T_SIZE;
@@ -258,8 +275,9 @@ int mm_init(void){
   return 0;
 }
 
-void *mm_malloc(size_t size){
-  size_t search_size = ALIGN(PAD(size) + 2*SIZE_T_SIZE);
+/* an allocated block of at least search_size bytes, which must already be
+   aligned and padded; returns its payload */
+static void *alloc_block(size_t search_size){
   free_blk_header_t *fit = good_fit(search_size);
   /* if a fit was found, try splitting and then remove the fit from its list - otherwise, grow heap*/
   if (fit){
@@ -273,21 +291,25 @@ void *mm_malloc(size_t size){
   return (char *)fit + SIZE_T_SIZE;
 }
 
-void mm_free(void *ptr){
+static void *heap_malloc(size_t size){
+  return alloc_block(ALIGN(PAD(size) + 2*SIZE_T_SIZE));
+}
+
+static void heap_free(void *ptr){
   free_blk_header_t *freed = populate_free_blk_tags(BLOCK_HEADER(ptr), BLOCK_SIZE(BLOCK_HEADER(ptr)));
   free_blk_header_t *coalesced = coalesce(freed);
   free_list_insert(coalesced);
 }
 
-void *mm_realloc(void *ptr, size_t size){
+static void *heap_realloc(void *ptr, size_t size){
   size_t old_size = BLOCK_SIZE(BLOCK_HEADER(ptr));
   size_t new_size = ALIGN(size + 2*SIZE_T_SIZE);
   /* trivial cases */
   if (ptr == NULL){
-    return mm_malloc(size);
+    return heap_malloc(size);
   }
   else if (size == 0){
-    mm_free(ptr);
+    heap_free(ptr);
     return NULL;
   }
   else if (old_size >= new_size){
@@ -309,7 +331,7 @@ void *mm_realloc(void *ptr, size_t size){
   /* next block free, too small, but is the last block - grow the heap by just enough to fit the new size */
   else if (!ALLOCATED(next_block) && NEXT_BLOCK(next_block) == epilogue){
     ll_free_blk_remove(next_block);
-    grow_heap(new_size - old_size + next_size);
+    grow_heap(new_size - old_size - next_size);
     header = BLOCK_HEADER(ptr);
     footer = BLOCK_FOOTER(NEXT_BLOCK(next_block));
     *header = new_size | 1;
@@ -327,9 +349,189 @@ void *mm_realloc(void *ptr, size_t size){
   }
   /* need to actually reallocate and copy */
   else {
-    void *new = mm_malloc(size);
+    void *new = heap_malloc(size);
     memcpy(new, ptr, old_size - 2*SIZE_T_SIZE);
-    mm_free(ptr);
+    heap_free(ptr);
     return new;
   }
 }
+
+#ifndef MM_THREADS
+
+int mm_init(void){
+  return heap_init();
+}
+
+void *mm_malloc(size_t size){
+  return heap_malloc(size);
+}
+
+void mm_free(void *ptr){
+  heap_free(ptr);
+}
+
+void *mm_realloc(void *ptr, size_t size){
+  return heap_realloc(ptr, size);
+}
+
+size_t dbg_heap_allocated(void){
+  return heap_allocated();
+}
+
+#else
+
+/* thread-safe mode, built with -DMM_THREADS. the heap above is shared and
+   only touched with heap_lock held. in front of it each thread keeps a
+   cache of small blocks per size class, linked through their payloads.
+   cached blocks stay marked allocated, so the heap never coalesces them
+   and a cache hit or a free into the cache touches nothing shared. an
+   empty class is refilled with TCACHE_FILL blocks under one lock, and a
+   class holding more than TCACHE_MAX gives half back. large requests and
+   realloc go straight to the heap. */
+
+#define TCACHE_MIN 64       /* the smallest block heap_malloc makes */
+#define TCACHE_STEP 16
+#define TCACHE_CLASSES 61   /* blocks of 64 to 1024 bytes */
+#define TCACHE_FILL 8
+#define TCACHE_MAX 16
+#define CLASS_SIZE(c) (TCACHE_MIN + (c) * TCACHE_STEP)
+
+typedef struct tcache {
+  void *head[TCACHE_CLASSES];
+  unsigned count[TCACHE_CLASSES];
+  int registered;   /* tcache_key is set, so exiting gives the blocks back */
+} tcache_t;
+
+static __thread tcache_t tcache;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+static void *tcache_pop(tcache_t *tc, int c){
+  void *p = tc->head[c];
+  tc->head[c] = *(void **)p;
+  tc->count[c]--;
+  return p;
+}
+
+static void tcache_push(tcache_t *tc, int c, void *p){
+  *(void **)p = tc->head[c];
+  tc->head[c] = p;
+  tc->count[c]++;
+}
+
+/* hands up to n of class c's blocks back to the heap - heap_lock must be held */
+static void tcache_flush(tcache_t *tc, int c, unsigned n){
+  while (n-- > 0 && tc->head[c]){
+    heap_free(tcache_pop(tc, c));
+  }
+}
+
+/* the first push into a thread's cache, from mm_malloc or mm_free, sets
+   tcache_key so the cache is given back when the thread exits */
+static void tcache_register(tcache_t *tc){
+  if (!tc->registered){
+    pthread_setspecific(tcache_key, tc);
+    tc->registered = 1;
+  }
+}
+
+/* tcache_key's destructor: a thread's cached blocks would otherwise be lost when it exits */
+static void tcache_release(void *arg){
+  tcache_t *tc = arg;
+  int c;
+  pthread_mutex_lock(&heap_lock);
+  for (c = 0; c < TCACHE_CLASSES; c++){
+    tcache_flush(tc, c, tc->count[c]);
+  }
+  pthread_mutex_unlock(&heap_lock);
+}
+
+static void tcache_key_create(void){
+  pthread_key_create(&tcache_key, tcache_release);
+}
+
+/* like the single-threaded mm_init, this starts a fresh heap, so no other
+   thread may be using it - threads that have exited already gave their
+   caches back */
+int mm_init(void){
+  int ret;
+  pthread_once(&tcache_once, tcache_key_create);
+  /* the caller's cache points into the heap being replaced */
+  memset(tcache.head, 0, sizeof(tcache.head));
+  memset(tcache.count, 0, sizeof(tcache.count));
+  pthread_mutex_lock(&heap_lock);
+  ret = heap_init();
+  pthread_mutex_unlock(&heap_lock);
+  return ret;
+}
+
+void *mm_malloc(size_t size){
+  size_t search_size = ALIGN(PAD(size) + 2*SIZE_T_SIZE);
+  tcache_t *tc = &tcache;
+  void *p;
+  int c, i;
+  if (search_size > CLASS_SIZE(TCACHE_CLASSES - 1)){
+    pthread_mutex_lock(&heap_lock);
+    p = alloc_block(search_size);
+    pthread_mutex_unlock(&heap_lock);
+    return p;
+  }
+  /* round up, so whatever the class holds is big enough */
+  c = (search_size - TCACHE_MIN + TCACHE_STEP - 1) / TCACHE_STEP;
+  if (tc->head[c] == NULL){
+    tcache_register(tc);
+    pthread_mutex_lock(&heap_lock);
+    for (i = 0; i < TCACHE_FILL; i++){
+      tcache_push(tc, c, alloc_block(CLASS_SIZE(c)));
+    }
+    pthread_mutex_unlock(&heap_lock);
+  }
+  return tcache_pop(tc, c);
+}
+
+void mm_free(void *ptr){
+  size_t size = BLOCK_SIZE(BLOCK_HEADER(ptr));
+  tcache_t *tc = &tcache;
+  /* round down - a block that didn't split may be bigger than its class */
+  size_t c = (size - TCACHE_MIN) / TCACHE_STEP;
+  if (c >= TCACHE_CLASSES){
+    pthread_mutex_lock(&heap_lock);
+    heap_free(ptr);
+    pthread_mutex_unlock(&heap_lock);
+    return;
+  }
+  tcache_register(tc);
+  tcache_push(tc, c, ptr);
+  if (tc->count[c] > TCACHE_MAX){
+    pthread_mutex_lock(&heap_lock);
+    tcache_flush(tc, c, TCACHE_MAX / 2);
+    pthread_mutex_unlock(&heap_lock);
+  }
+}
+
+void *mm_realloc(void *ptr, size_t size){
+  void *p;
+  if (ptr == NULL){
+    return mm_malloc(size);
+  }
+  else if (size == 0){
+    mm_free(ptr);
+    return NULL;
+  }
+  pthread_mutex_lock(&heap_lock);
+  p = heap_realloc(ptr, size);
+  pthread_mutex_unlock(&heap_lock);
+  return p;
+}
+
+/* blocks in any live thread's cache count as allocated */
+size_t dbg_heap_allocated(void){
+  size_t total;
+  pthread_mutex_lock(&heap_lock);
+  total = heap_allocated();
+  pthread_mutex_unlock(&heap_lock);
+  return total;
+}
+
+#endif
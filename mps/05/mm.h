@@ -4,3 +4,6 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+
+/* bytes still in allocated blocks, for leak checks */
+extern size_t dbg_heap_allocated(void);
@@ -0,0 +1,311 @@
+/*
+ * mtdriver.c - multithreaded stress test and throughput benchmark for
+ * mm.c built with -DMM_THREADS.
+ *
+ * For 1, 2, 4, ... up to MAX_THREADS threads, every thread makes OPS
+ * random requests against a private array of LIVE slots: an empty slot
+ * gets a new block, a full one is freed or, now and then, realloc'ed.
+ * Most requests are small enough for the per-thread caches; one in
+ * eight is large and goes to the shared heap. Every so often a thread
+ * swaps a block with a shared mailbox instead, so blocks are freed by
+ * threads other than the one that allocated them. Each block carries
+ * its size and a tag at both ends, checked before it is freed, so two
+ * threads handed overlapping blocks show up as errors. The same run is
+ * repeated with libc malloc for comparison.
+ *
+ * With -c, each thread instead produces OPS blocks and hands them over a
+ * queue to a consumer thread of its own, which checks and frees them and
+ * never allocates. Once every thread has exited, nothing may be left
+ * allocated in the mm heap, so blocks a consumer cached but didn't give
+ * back when it exited show up as a leak.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define LIVE        512   /* slots per thread */
+#define SMALL_MAX   512   /* small requests are 1..SMALL_MAX bytes */
+#define LARGE_MAX  4096   /* large ones SMALL_MAX+1..LARGE_MAX */
+#define MIN_REQ     (3 * sizeof(size_t))  /* room for all three tags */
+#define QUEUE      1024   /* blocks in flight from a producer to its consumer */
+
+/* the allocator under test */
+typedef struct {
+    const char *name;
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+} allocator_t;
+
+/* single producer, single consumer ring of blocks */
+typedef struct {
+    char *slots[QUEUE];
+    unsigned long head;  /* next to take; only the consumer writes it */
+    unsigned long tail;  /* next to fill; only the producer writes it */
+} queue_t;
+
+/* one thread's work */
+typedef struct {
+    const allocator_t *a;
+    unsigned seed;
+    long ops;
+    long errors;
+    queue_t *q;          /* -c: where a producer sends its blocks */
+} worker_t;
+
+static void *mailbox;   /* a block waiting for another thread to free it */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* writes size and tag at the head of the block and tag at its tail */
+static void tag_block(char *p, size_t size, size_t tag)
+{
+    ((size_t *)p)[0] = size;
+    ((size_t *)p)[1] = tag;
+    memcpy(p + size - sizeof(size_t), &tag, sizeof(size_t));
+}
+
+/* returns 1 if the tags tag_block wrote are still intact */
+static int check_block(char *p)
+{
+    size_t size = ((size_t *)p)[0], tag = ((size_t *)p)[1], tail;
+    if (size < MIN_REQ || size > LARGE_MAX)
+        return 0;
+    memcpy(&tail, p + size - sizeof(size_t), sizeof(size_t));
+    return tail == tag;
+}
+
+static size_t random_size(unsigned *seed)
+{
+    size_t size;
+    if (rand_r(seed) % 8 == 0)
+        size = SMALL_MAX + 1 + rand_r(seed) % (LARGE_MAX - SMALL_MAX);
+    else
+        size = 1 + rand_r(seed) % SMALL_MAX;
+    return size < MIN_REQ ? MIN_REQ : size;
+}
+
+static void *worker(void *arg)
+{
+    worker_t *w = arg;
+    const allocator_t *a = w->a;
+    char *slots[LIVE] = { NULL }, *p;
+    size_t size;
+    long i;
+    int s;
+
+    for (i = 0; i < w->ops; i++) {
+        s = rand_r(&w->seed) % LIVE;
+        p = slots[s];
+        if (p == NULL) {
+            size = random_size(&w->seed);
+            p = a->malloc(size);
+            tag_block(p, size, (size_t)p ^ i);
+            slots[s] = p;
+            continue;
+        }
+        if (!check_block(p)) {
+            w->errors++;
+            slots[s] = NULL;
+            continue;
+        }
+        switch (rand_r(&w->seed) % 16) {
+        case 0:
+            /* realloc keeps the old tags, so retag for the new size */
+            size = random_size(&w->seed);
+            p = a->realloc(p, size);
+            tag_block(p, size, (size_t)p ^ i);
+            slots[s] = p;
+            break;
+        case 1:
+            /* ours goes to whoever takes from the mailbox next */
+            slots[s] = __atomic_exchange_n(&mailbox, p, __ATOMIC_ACQ_REL);
+            break;
+        default:
+            a->free(p);
+            slots[s] = NULL;
+        }
+    }
+    for (s = 0; s < LIVE; s++) {
+        if (slots[s]) {
+            if (!check_block(slots[s]))
+                w->errors++;
+            a->free(slots[s]);
+        }
+    }
+    return NULL;
+}
+
+/* -c: allocates ops blocks and queues them for the consumer */
+static void *producer(void *arg)
+{
+    worker_t *w = arg;
+    queue_t *q = w->q;
+    unsigned long tail;
+    size_t size;
+    char *p;
+    long i;
+
+    for (i = 0; i < w->ops; i++) {
+        size = random_size(&w->seed);
+        p = w->a->malloc(size);
+        tag_block(p, size, (size_t)p ^ i);
+        tail = q->tail;
+        while (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == QUEUE)
+            sched_yield();
+        q->slots[tail % QUEUE] = p;
+        __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/* -c: frees whatever its producer sends, ops blocks in all */
+static void *consumer(void *arg)
+{
+    worker_t *w = arg;
+    queue_t *q = w->q;
+    unsigned long head;
+    char *p;
+    long i;
+
+    for (i = 0; i < w->ops; i++) {
+        head = q->head;
+        while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == head)
+            sched_yield();
+        p = q->slots[head % QUEUE];
+        __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+        if (!check_block(p))
+            w->errors++;
+        w->a->free(p);
+    }
+    return NULL;
+}
+
+/* runs nthreads workers, or with pairs nthreads producer/consumer pairs,
+   to completion; returns the wall clock seconds */
+static double run(const allocator_t *a, int nthreads, int pairs, long ops,
+                  long *errors)
+{
+    int n = pairs ? 2 * nthreads : nthreads;
+    pthread_t *tids = malloc(sizeof(pthread_t) * n);
+    worker_t *ws = malloc(sizeof(worker_t) * n);
+    queue_t *qs = calloc(nthreads, sizeof(queue_t));
+    double start;
+    int i;
+
+    mailbox = NULL;
+    start = now();
+    for (i = 0; i < n; i++) {
+        ws[i].a = a;
+        ws[i].seed = 351 + i;
+        ws[i].ops = ops;
+        ws[i].errors = 0;
+        ws[i].q = &qs[i % nthreads];
+        if (pthread_create(&tids[i], NULL, !pairs ? worker
+                           : i < nthreads ? producer : consumer, &ws[i]) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+    *errors = 0;
+    for (i = 0; i < n; i++) {
+        pthread_join(tids[i], NULL);
+        *errors += ws[i].errors;
+    }
+    start = now() - start;
+    if (mailbox) {
+        if (!check_block(mailbox))
+            (*errors)++;
+        a->free(mailbox);
+    }
+    free(tids);
+    free(ws);
+    free(qs);
+    return start;
+}
+
+static void usage(char *prog)
+{
+    printf("Usage: %s [-h] [-c] [-t <max threads>] [-n <ops>]\n", prog);
+    printf("Options\n");
+    printf("\t-h         Print this message.\n");
+    printf("\t-c         Producer/consumer pairs, then check for leaks.\n");
+    printf("\t-t <n>     Go up to n threads (default: online cores).\n");
+    printf("\t-n <n>     Requests per thread (default 1000000).\n");
+    exit(0);
+}
+
+int main(int argc, char **argv)
+{
+    static const allocator_t mm = { "mm", mm_malloc, mm_free, mm_realloc };
+    static const allocator_t libc = { "libc", malloc, free, realloc };
+    int c, t, pairs = 0, max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    long ops = 1000000, mm_errors, libc_errors;
+    double mm_secs, libc_secs, base = 0;
+    size_t leaked;
+
+    while ((c = getopt(argc, argv, "hct:n:")) != EOF) {
+        switch (c) {
+        case 'c':
+            pairs = 1;
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            ops = atol(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (max_threads < 1 || ops < 1)
+        usage(argv[0]);
+
+    mem_init();
+    if (pairs)
+        printf("%ld blocks per producer/consumer pair\n", ops);
+    else
+        printf("%ld requests per thread, %d slots each\n", ops, LIVE);
+    printf("threads  mm Kops   scaling  heap KB  libc Kops  errors\n");
+    for (t = 1; ; t = t * 2 < max_threads ? t * 2 : max_threads) {
+        mem_reset_brk();
+        if (mm_init() < 0) {
+            fprintf(stderr, "mm_init failed\n");
+            exit(1);
+        }
+        mm_secs = run(&mm, t, pairs, ops, &mm_errors);
+        /* every thread has exited, so every cached block is back too */
+        if (pairs && (leaked = dbg_heap_allocated()) != 0) {
+            printf("ERROR: %lu bytes still allocated after every block was freed\n",
+                   (unsigned long)leaked);
+            exit(1);
+        }
+        libc_secs = run(&libc, t, pairs, ops, &libc_errors);
+        if (t == 1)
+            base = ops / mm_secs;
+        printf("%7d %8.0f %8.2fx %8lu %10.0f  %6ld\n", t, t * ops / mm_secs / 1e3,
+               t * ops / mm_secs / base, (unsigned long)(mem_heapsize() / 1024),
+               t * ops / libc_secs / 1e3, mm_errors + libc_errors);
+        if (mm_errors + libc_errors) {
+            printf("ERROR: blocks were corrupted\n");
+            exit(1);
+        }
+        if (t == max_threads)
+            break;
+    }
+    mem_deinit();
+    return 0;
+}